@@ -0,0 +1,200 @@
+/*
+	lz4fio-train
+
+	builds a dictionary for lz4open_dict from sample files
+
+	lz4fio-train [-o dict] [-s size] [-t threads] [-l level] [-n] files...
+
+	-o	the dictionary file to write, "dictionary" by default
+	-s	the dictionary size, at most and by default 65536
+	-t	the worker threads, one per cpu by default
+	-l	the level the ratio is measured at as in "wN", 9 by default
+	-n	every line of the files is a sample instead of every file
+
+	Every tenth sample, or the last one when there are fewer, is
+	held out of training, and the ratio on those is reported both
+	with and without the dictionary.
+*/
+#include "lz4fio.h"
+#include <string.h>
+#include <stdlib.h>
+
+struct sample_s
+{
+	size_t off;
+	size_t size;
+};
+
+// append the file at fname to *pp
+bool read_file( const char* fname, char** pp, size_t* pn, size_t* pcap )
+{
+	FILE* fp = fopen(fname,"rb");
+	if(NULL==fp)
+		return false;
+	for(;;)
+	{
+		if(*pn==*pcap)
+		{
+			size_t cap = (0==*pcap) ? 1024*1024 : 2 * *pcap;
+			char* p = (char*)realloc( *pp, cap );
+			if(NULL==p)
+				break;
+			*pp = p;
+			*pcap = cap;
+		}
+		size_t k = fread( *pp + *pn, 1, *pcap - *pn, fp );
+		*pn += k;
+		if(0==k)
+			break;
+	}
+	bool ok = 0==ferror(fp) && 0!=feof(fp);
+	fclose(fp);
+	return ok;
+}
+
+// copy the samples with pick set to p and their sizes to psizes
+size_t gather( const char* pall, const sample_s* ps, const size_t ns, const bool pick, char* p, size_t* psizes )
+{
+	size_t n = 0;
+	size_t k = 0;
+	for(size_t i=0; i<ns; ++i)
+	{
+		bool held = (10 <= ns) ? (9 == i%10) : (i+1 == ns);
+		if(held != pick)
+			continue;
+		memcpy( p+n, pall+ps[i].off, ps[i].size );
+		n += ps[i].size;
+		psizes[k++] = ps[i].size;
+	}
+	return k;
+}
+
+int main( int argc, char** argv )
+{
+	const char* fndict = "dictionary";
+	size_t ndict = 64*1024;
+	int threads = 0;
+	int level = 9;
+	bool lines = false;
+	int a = 1;
+	for(; a<argc && '-'==argv[a][0]; ++a)
+	{
+		char c = argv[a][1];
+		if('n'==c)
+			lines = true;
+		else
+		if(a+1 < argc && 'o'==c)
+			fndict = argv[++a];
+		else
+		if(a+1 < argc && 's'==c)
+			ndict = (size_t)atol(argv[++a]);
+		else
+		if(a+1 < argc && 't'==c)
+			threads = atoi(argv[++a]);
+		else
+		if(a+1 < argc && 'l'==c)
+			level = atoi(argv[++a]);
+		else
+			break;
+	}
+	if(a>=argc || 0==ndict || 64*1024<ndict || 0>threads)
+	{
+		fprintf(stderr,"usage: lz4fio-train [-o dict] [-s size] [-t threads] [-l level] [-n] files...\n");
+		return 1;
+	}
+
+	char* pall = NULL;
+	size_t nall = 0;
+	size_t cap = 0;
+	sample_s* ps = (sample_s*)malloc( sizeof(sample_s) * 1024 );
+	size_t ns = 0;
+	size_t scap = 1024;
+	for(; a<argc; ++a)
+	{
+		size_t off = nall;
+		if(!read_file( argv[a], &pall, &nall, &cap ))
+		{
+			fprintf(stderr,"lz4fio-train: cannot read %s\n",argv[a]);
+			return 1;
+		}
+		while(off < nall)
+		{
+			const char* eol = lines ? (const char*)memchr( pall+off, '\n', nall-off ) : NULL;
+			size_t k = (NULL==eol) ? nall-off : (size_t)(eol - (pall+off)) + 1;
+			if(ns==scap)
+			{
+				scap *= 2;
+				ps = (sample_s*)realloc( ps, sizeof(sample_s) * scap );
+			}
+			if(NULL==ps)
+			{
+				fprintf(stderr,"lz4fio-train: out of memory\n");
+				return 1;
+			}
+			ps[ns].off = off;
+			ps[ns].size = k;
+			++ns;
+			off += k;
+		}
+	}
+	if(0==ns)
+	{
+		fprintf(stderr,"lz4fio-train: no samples\n");
+		return 1;
+	}
+
+	char* ptrain = (char*)malloc( nall + 1 );
+	char* pheld = (char*)malloc( nall + 1 );
+	size_t* ztrain = (size_t*)malloc( sizeof(size_t) * ns );
+	size_t* zheld = (size_t*)malloc( sizeof(size_t) * ns );
+	char* pdict = (char*)malloc( ndict );
+	if(NULL==ptrain || NULL==pheld || NULL==ztrain || NULL==zheld || NULL==pdict)
+	{
+		fprintf(stderr,"lz4fio-train: out of memory\n");
+		return 1;
+	}
+	size_t ntrain = gather( pall, ps, ns, false, ptrain, ztrain );
+	size_t nheld = gather( pall, ps, ns, true, pheld, zheld );
+	if(0==ntrain)
+	{
+		// a single sample is both trained and measured on
+		ntrain = gather( pall, ps, ns, true, ptrain, ztrain );
+	}
+
+	size_t zdict = lz4dict_train( pdict, ndict, ptrain, ztrain, ntrain, threads );
+	if(0==zdict)
+	{
+		fprintf(stderr,"lz4fio-train: training failed with error %d\n",lz4ferr);
+		return 1;
+	}
+	FILE* fp = fopen(fndict,"wb");
+	bool written = NULL!=fp && zdict==fwrite( pdict, 1, zdict, fp );
+	if(NULL!=fp && 0!=fclose(fp))
+		written = false;
+	if(!written)
+	{
+		// a partial dictionary would be taken for a good one
+		if(NULL!=fp)
+			remove(fndict);
+		fprintf(stderr,"lz4fio-train: cannot write %s\n",fndict);
+		return 1;
+	}
+	printf("samples    : %lu, %lu bytes\n",(unsigned long)ns,(unsigned long)nall);
+	printf("dictionary : %s, %lu bytes, id %08x\n",fndict,(unsigned long)zdict,lz4dictid_of(pdict,zdict));
+	double rplain = lz4dict_ratio( NULL, 0, pheld, zheld, nheld, level, threads );
+	double rdict = lz4dict_ratio( pdict, zdict, pheld, zheld, nheld, level, threads );
+	if(0<nheld && 0<rplain && 0<rdict)
+	{
+		printf("held out   : %lu samples at level %d\n",(unsigned long)nheld,level);
+		printf("ratio      : %.3f without, %.3f with the dictionary\n",rplain,rdict);
+	}
+
+	free(pall);
+	free(ps);
+	free(ptrain);
+	free(pheld);
+	free(ztrain);
+	free(zheld);
+	free(pdict);
+	return 0;
+}
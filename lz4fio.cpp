@@ -40,6 +40,7 @@
 #include "lz4/lz4.h"
 #include "lz4/lz4hc.h"
 #include "lz4/xxhash.h"
+#include "lz4/lz4frame.h"
 ////////////////////////
 
 ////////////////////
@@ -53,14 +54,377 @@
 #include <string.h>
 #include <stddef.h>
 #include <ctype.h>
+#include <stdlib.h>
+////////////////////
+
+////////////////////
+// C++ RTL headers
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <new>
 ////////////////////
 
 //////////////////////////////////////////////////////
 // os specific functions
 bool set_page_lock( unsigned char* a, const bool v );
 size_t get_page_size();
+size_t get_cpu_count();
+bool set_file_pos( FILE* fp, const long long off, const int whence );
+long long get_file_pos( FILE* fp );
+long long get_file_size( const int fd );
+bool read_file_at( const int fd, void* p, const size_t n, const unsigned long long off );
+int get_file_fd( FILE* fp );
+FILE* open_file_fdopen( const int fd, const char* fmode );
+void close_file_keep_fd( FILE* fp, const int fd );
+int open_file_fd( const char* fname, const char fmode );
+void close_file_fd( const int fd );
+long long seek_file_fd( const int fd, const long long off, const int whence );
+size_t read_file_v( const int fd, void* p, const size_t n, void* q, const size_t m );
+size_t write_file_v( const int fd, const void* p, const size_t n, const void* q, const size_t m );
+const unsigned char* map_file( const int fd, size_t& z );
+void unmap_file( const unsigned char* p, const size_t z );
 //////////////////////////////////////////////////////
 
+/*
+	where the compressed stream lives, a stdio FILE or memory
+
+	memory being read belongs to the caller and is used in place,
+	memory being written grows with realloc and is handed back
+	through pmem and pmemsize when the stream is closed
+
+	callbacks from lz4open_io are used when vt is set, m keeps
+	positional reads from moving the position under other calls
+
+	a descriptor opened with "u" is used when fd is set, without
+	stdio in between, a block goes out in one gathered write and
+	comes in with the header of the next block in one read
+
+	the calls follow fread, fwrite, fseek and friends
+*/
+struct lz4f_io_s
+{
+	FILE* file;		// stdio file or NULL for memory
+	int fd;			// descriptor used without stdio or -1
+	bool fdeof;		// a descriptor read came up short
+	unsigned char ahead[8];	// bytes read past the last request
+	size_t nahead;	// bytes waiting in ahead
+	const lz4f_io_vtable_s* vt;	// caller callbacks or NULL
+	void* user;		// passed to the callbacks
+	bool vteof;		// a callback read came up short
+	std::mutex m;	// serializes the callbacks
+	unsigned char* mem;	// memory contents
+	size_t memsize;	// bytes of content at mem
+	size_t memcap;	// bytes allocated at mem when writing
+	size_t mempos;	// offset of the next read or write
+	bool memeof;	// a read ran past memsize
+	void** pmem;		// receives mem on close when writing
+	size_t* pmemsize;	// receives memsize on close when writing
+	const unsigned char* fmap;	// mapping of file or NULL
+	size_t fmapsize;	// bytes at fmap
+
+	lz4f_io_s():file(NULL),fd(-1),fdeof(false),nahead(0),vt(NULL),user(NULL),vteof(false),mem(NULL),memsize(0),memcap(0),mempos(0),memeof(false),pmem(NULL),pmemsize(NULL),fmap(NULL),fmapsize(0)
+	{
+	}
+
+	// whole callback transfers, short counts are retried until 0
+	size_t vt_read( void* p, const size_t nb )
+	{
+		size_t done = 0;
+		while(done < nb)
+		{
+			size_t k = vt->read( user, (char*)p + done, nb - done );
+			if(0==k || nb - done < k)
+				break;
+			done += k;
+		}
+		if(done < nb)
+			vteof = true;
+		return done;
+	}
+
+	size_t vt_write( const void* p, const size_t nb )
+	{
+		size_t done = 0;
+		while(done < nb)
+		{
+			size_t k = vt->write( user, (const char*)p + done, nb - done );
+			if(0==k || nb - done < k)
+				break;
+			done += k;
+		}
+		return done;
+	}
+
+	long long vt_seek( const long long off, const int whence )
+	{
+		return (NULL==vt->seek) ? -1 : vt->seek( user, off, whence );
+	}
+
+	/*
+		fill nb bytes at p from the descriptor, and when na is not
+		0 read up to na bytes more into ahead with the same call
+	*/
+	size_t fd_read( void* p, const size_t nb, const size_t na )
+	{
+		size_t done = std::min( nb, nahead );
+		memcpy( p, ahead, done );
+		memmove( ahead, ahead + done, nahead - done );
+		nahead -= done;
+		while(done < nb)
+		{
+			size_t k = read_file_v( fd, (char*)p + done, nb - done, ahead, (0==nahead) ? na : 0 );
+			if(0==k)
+				break;
+			if(nb - done < k)
+			{
+				nahead = k - (nb - done);
+				k = nb - done;
+			}
+			done += k;
+		}
+		if(done < nb)
+			fdeof = true;
+		return done;
+	}
+
+	size_t fd_write( const void* p, const size_t nb, const void* q, const size_t nq )
+	{
+		size_t done = 0;
+		while(done < nb + nq)
+		{
+			size_t k = (done < nb)
+				? write_file_v( fd, (const char*)p + done, nb - done, q, nq )
+				: write_file_v( fd, (const char*)q + (done - nb), nb + nq - done, NULL, 0 );
+			if(0==k)
+				break;
+			done += k;
+		}
+		return done;
+	}
+
+	/*
+		read n bytes at p, a descriptor also reads up to na bytes
+		past them so the next small read needs no call
+	*/
+	size_t read_ahead( void* p, const size_t n, const size_t na )
+	{
+		if(0>fd)
+			return read( p, 1, n );
+		return fd_read( p, n, std::min( na, sizeof(ahead) ) );
+	}
+
+	// write n bytes at p and nq bytes at q, as one call when possible
+	bool write2( const void* p, const size_t n, const void* q, const size_t nq )
+	{
+		if(0>fd)
+			return 1==write( p, n, 1 ) && 1==write( q, nq, 1 );
+		return n + nq == fd_write( p, n, q, nq );
+	}
+
+	size_t read( void* p, const size_t z, const size_t n )
+	{
+		if(NULL!=file)
+			return fread( p, z, n, file );
+		if(0<=fd)
+			return (0<z) ? fd_read( p, z*n, 0 ) / z : 0;
+		if(NULL!=vt)
+		{
+			if(0==z || NULL==vt->read)
+				return 0;
+			std::lock_guard<std::mutex> lock(m);
+			return vt_read( p, z*n ) / z;
+		}
+		size_t avail = (mempos < memsize) ? memsize - mempos : 0;
+		size_t k = (0<z) ? std::min( n, avail/z ) : 0;
+		if(k < n)
+			memeof = true;
+		memcpy( p, mem + mempos, k*z );
+		mempos += k*z;
+		return k;
+	}
+
+	size_t write( const void* p, const size_t z, const size_t n )
+	{
+		if(NULL!=file)
+			return fwrite( p, z, n, file );
+		size_t nb = z*n;
+		if(0<z && nb/z != n)
+			return 0;
+		if(0<=fd)
+			return (0<z) ? fd_write( p, nb, NULL, 0 ) / z : 0;
+		if(NULL!=vt)
+		{
+			if(0==z || NULL==vt->write)
+				return 0;
+			std::lock_guard<std::mutex> lock(m);
+			return vt_write( p, nb ) / z;
+		}
+		if(memcap - mempos < nb)
+		{
+			// grow geometrically so a stream costs few reallocs
+			size_t need = mempos + nb;
+			if(need < mempos)
+				return 0;
+			size_t cap = std::max( std::max( need, 2*memcap ), (size_t)4096 );
+			unsigned char* pm = (unsigned char*)realloc( mem, cap );
+			if(NULL==pm)
+				return 0;
+			mem = pm;
+			memcap = cap;
+		}
+		memcpy( mem + mempos, p, nb );
+		mempos += nb;
+		memsize = std::max( memsize, mempos );
+		return n;
+	}
+
+	bool seek( const long long off, const int whence )
+	{
+		if(NULL!=file)
+			return set_file_pos( file, off, whence );
+		if(0<=fd)
+		{
+			// bytes read ahead are still ahead of the position
+			long long at = seek_file_fd( fd, off - ((SEEK_CUR==whence) ? (long long)nahead : 0), whence );
+			if(0 > at)
+				return false;
+			nahead = 0;
+			fdeof = false;
+			return true;
+		}
+		if(NULL!=vt)
+		{
+			std::lock_guard<std::mutex> lock(m);
+			vteof = false;
+			return 0 <= vt_seek( off, whence );
+		}
+		long long at = off;
+		if(SEEK_CUR==whence)
+			at += mempos;
+		if(SEEK_END==whence)
+			at += memsize;
+		if(0>at || (unsigned long long)at > memsize)
+			return false;
+		mempos = (size_t)at;
+		memeof = false;
+		return true;
+	}
+
+	long long tell()
+	{
+		if(NULL!=file)
+			return get_file_pos( file );
+		if(0<=fd)
+		{
+			long long at = seek_file_fd( fd, 0, SEEK_CUR );
+			return (0 > at) ? at : at - (long long)nahead;
+		}
+		if(NULL!=vt)
+		{
+			std::lock_guard<std::mutex> lock(m);
+			return vt_seek( 0, SEEK_CUR );
+		}
+		return (long long)mempos;
+	}
+
+	long long size()
+	{
+		if(NULL!=file)
+			return get_file_size( get_file_fd( file ) );
+		if(0<=fd)
+			return get_file_size( fd );
+		if(NULL!=vt)
+		{
+			std::lock_guard<std::mutex> lock(m);
+			long long at = vt_seek( 0, SEEK_CUR );
+			if(0 > at)
+				return -1;
+			long long z = vt_seek( 0, SEEK_END );
+			if(at != vt_seek( at, SEEK_SET ))
+				return -1;
+			return z;
+		}
+		return (long long)memsize;
+	}
+
+	bool read_at( void* p, const size_t n, const unsigned long long off )
+	{
+		if(NULL!=file)
+			return read_file_at( get_file_fd( file ), p, n, off );
+		if(0<=fd)
+			return read_file_at( fd, p, n, off );
+		if(NULL!=vt)
+		{
+			// seek there and back again under the lock
+			if(NULL==vt->read)
+				return false;
+			std::lock_guard<std::mutex> lock(m);
+			long long at = vt_seek( 0, SEEK_CUR );
+			if(0 > at || (long long)off != vt_seek( (long long)off, SEEK_SET ))
+				return false;
+			bool was = vteof;
+			bool ok = (n == vt_read( p, n ));
+			vteof = was;
+			return (at == vt_seek( at, SEEK_SET )) && ok;
+		}
+		if(off > memsize || n > memsize - off)
+			return false;
+		memcpy( p, mem + off, n );
+		return true;
+	}
+
+	// the whole stream as one block of memory or NULL
+	const unsigned char* map( size_t& z )
+	{
+		if(NULL!=vt)
+			return NULL;
+		if(NULL==file && 0>fd)
+		{
+			z = memsize;
+			return mem;
+		}
+		if(NULL==fmap)
+			fmap = map_file( (0<=fd) ? fd : get_file_fd( file ), fmapsize );
+		z = fmapsize;
+		return fmap;
+	}
+
+	int eof()
+	{
+		if(NULL!=file)
+			return feof( file );
+		if(0<=fd)
+			return fdeof ? 1 : 0;
+		if(NULL!=vt)
+			return vteof ? 1 : 0;
+		return memeof ? 1 : 0;
+	}
+
+	int close()
+	{
+		if(NULL!=fmap)
+			unmap_file( fmap, fmapsize );
+		fmap = NULL;
+		if(NULL!=file)
+			return fclose( file );
+		if(0<=fd)
+		{
+			close_file_fd( fd );
+			return 0;
+		}
+		if(NULL!=vt)
+			return (NULL==vt->close) ? 0 : vt->close( user );
+		if(NULL!=pmem)
+		{
+			*pmem = mem;
+			*pmemsize = memsize;
+		}
+		return 0;
+	}
+};
+
 ///////////////////////////////////////////
 // the lz4f error code
 #if _WIN32
@@ -338,89 +702,128 @@ lz4f_header_s lz4f_init_header()
 	return h;
 }
 
+/*
+	bit in lz4c.rffu of a header written once up front by a
+	streaming writer, the final content size and header checksum
+	then travel in the index tail after the end mark
+*/
+#define LZ4F_RFFU_STREAM	0x01
+
+/*
+	bit in lz4c.rffu of a header followed by the 4 byte id of the
+	dictionary the blocks were compressed against
+*/
+#define LZ4F_RFFU_DICT	0x02
+
+// the HC byte of h computed as described above
+unsigned char lz4f_header_checksum( lz4f_header_s h )
+{
+	h.lz4c.hc = 0;
+	return ((XXH32(&h,sizeof(h),0))>>8) & 0xff;
+}
+
 size_t min( const size_t a, const size_t b )
 {
 	return (a<=b)?a:b;
 }
 
+/*
+	block sizes selected by the b_maxsize field of the header
+
+	the lz4 frame format defines 4 to 7 for 64KB to 4MB and the
+	same progression extends down to 2 for 4KB and 3 for 16KB
+*/
+#define LZ4F_BMAX_MIN	2	// 4KB
+#define LZ4F_BMAX_DEF	4	// 64KB
+#define LZ4F_BMAX_MAX	7	// 4MB
+
+size_t lz4f_block_size( const int b_maxsize )
+{
+	if(LZ4F_BMAX_MIN > b_maxsize || LZ4F_BMAX_MAX < b_maxsize)
+		return 0;
+	return ((size_t)1) << (8 + 2*b_maxsize);
+}
+
 struct lz4fbuf_s
 {
 	unsigned char* _heap;
 	unsigned char* _buf0;
 	unsigned char* _bufi;
 	unsigned char* _bufz;
-
-#define BUFSIZE 0x10000
+	size_t _size;	// usable capacity starting at _buf0
 
 #ifdef _WIN32
 	bool set_buffer_wall( const bool pref, const bool suff )
 	{
+		size_t page_size = get_page_size();
 		return(true
 			&& set_page_lock( _buf0-8, pref )
-			&& set_page_lock( _buf0+BUFSIZE, suff )
+			&& set_page_lock( _buf0+((_size + page_size - 1) & ~(page_size - 1)), suff )
 		);
 	}
 #else
-	bool set_buffer_wall( const bool pref, const bool suff )
+	bool set_buffer_wall( const bool /*pref*/, const bool /*suff*/ )
 	{
 		// add linux and mac support here
+		return true;
 	}
 #endif
 
-	lz4fbuf_s():_heap(NULL),_buf0(NULL),_bufi(NULL),_bufz(NULL)
+	lz4fbuf_s():_heap(NULL),_buf0(NULL),_bufi(NULL),_bufz(NULL),_size(0)
+	{
+	}
+
+	bool alloc( const size_t n )
 	{
-		_heap = new unsigned char[ BUFSIZE * 3 ];
+		assert( NULL==_heap );
+		size_t page_size = get_page_size();
+		/*
+			round the capacity up to whole pages and allocate
+			room for alignment plus one wall page on each side
+		*/
+		_size = n;
+		_heap = new unsigned char[ ((n + page_size - 1) & ~(page_size - 1)) + page_size * 3 ];
 		if(NULL==_heap)
 		{
 			lz4ferr = lz4f_fail_heap;
-			return;
+			return false;
 		}
 		unsigned long long a = (unsigned long long)_heap;
 		/*
 			position the working _buf0 such that it is
-			64k page aligned and there is a minimum of 
+			page aligned and there is a minimum of 
 			one prefix page allocated between _heap and
 			_buf0
 		*/
-		size_t page_size = get_page_size();
-
-		a += (page_size + BUFSIZE - 1); a = ~a; a |= (BUFSIZE-1); a = ~a;
+		a += (page_size + page_size - 1); a = ~a; a |= (page_size-1); a = ~a;
 		//////////////////////////////////////////
 		_buf0 = (unsigned char*)a;
 		_bufi = _buf0;
-		_bufz = _buf0 + BUFSIZE;
+		_bufz = _buf0 + _size;
 		assert( page_size <= (size_t)(_buf0-_heap) );
 		set_buffer_wall(true,true);
+		return true;
 	}
 
 	void init( const char bmode, const char fmode )
 	{
+		assert( 'c'==bmode || 'd'==bmode );
 		_bufi = _buf0;
-		_bufz = _buf0 + BUFSIZE;
+		_bufz = _buf0 + _size;
 		if('d'==bmode)
 		{
 			if('r'==fmode)
 				_bufz = _buf0;
 		}
-		else
-		if('c'==bmode)
-		{
-			if('w'==fmode)
-			{
-				/*
-					The act of compression "could" have a negative result
-					where the compressed data is larger than the source
-					and in this would be a buffer overflow.  We detect 
-					this in the result value and take action there by
-					setting the not-compressed bit.
-				*/
-				set_buffer_wall(true,false);
-			}
-		}
-		else
-		{
-			assert(false);
-		}
+	}
+
+	void swap( lz4fbuf_s& b )
+	{
+		std::swap( _heap, b._heap );
+		std::swap( _buf0, b._buf0 );
+		std::swap( _bufi, b._bufi );
+		std::swap( _bufz, b._bufz );
+		std::swap( _size, b._size );
 	}
 
 	~lz4fbuf_s()
@@ -428,7 +831,7 @@ struct lz4fbuf_s
 		if(NULL!=_heap)
 		{
 			set_buffer_wall(false,false);
-			delete _heap;
+			delete [] _heap;
 			_heap=NULL;
 		}
 	}
@@ -450,396 +853,3200 @@ struct lz4fbuf_s
 		_bufi += rem;
 		return rem;
 	}
-	size_t gets( char* pbytes, const size_t nbytes )
+	/*
+		length of the next nbytes at most up to and including the
+		first delim, the search is left to memchr which the C-RTL
+		vectorises
+	*/
+	size_t find( const size_t nbytes, const int delim, bool& found ) const
 	{
-		char* pfr = pbytes;
-		char* pto = pbytes+nbytes-1;
-		while ( pfr < pto && _bufi < _bufz )
-		{
-			if('\n' == (*pfr++ = *_bufi++))
-			{
-				break;
-			}
-		}
-		*pfr=0;
-		return pfr-pbytes;
+		size_t rem = min(remaining(),nbytes);
+		unsigned char* pz = (unsigned char*)memchr( _bufi,delim,rem );
+		found = (NULL!=pz);
+		if(found)
+			rem = pz + 1 - _bufi;
+		return rem;
+	}
+	/*
+		copy at most nbytes up to and including the first delim
+	*/
+	size_t getdelim( char* pbytes, const size_t nbytes, const int delim, bool& found )
+	{
+		return read( pbytes, find(nbytes,delim,found) );
 	}
 };
 
+/*
+	allocate a compressed and decompressed buffer pair for blocks of
+	bsize bytes, c is sized so that compression can never overflow it
+*/
+bool lz4f_alloc_block( lz4fbuf_s& c, lz4fbuf_s& d, const size_t bsize, const char fmode )
+{
+	if(!c.alloc( LZ4_compressBound((int)bsize) ))
+		return false;
+	if(!d.alloc( bsize ))
+		return false;
+	c.init('c',fmode);
+	d.init('d',fmode);
+	return true;
+}
+
 struct lz4f_sizes_s
 {
 	int d_size;	// uncompressed size
 	int c_size;	// compressed size
 };
 
-struct lz4f_buffers_s
+#define NCBIT 0x80000000
+
+/*
+	the id a dictionary is recorded under, a hash of the last 64KB
+	which are all that lz4 uses, 0 is kept for no dictionary
+*/
+unsigned int lz4f_dict_id( const void* p, const size_t n )
 {
-	lz4fbuf_s	c;	// compressed
-	lz4fbuf_s	d;	// decompressed
-	int complvl;	// compression level
-	char fmode;		// 'r' or 'w'
+	size_t k = std::min( n, (size_t)64*1024 );
+	unsigned int id = XXH32( (const char*)p + (n - k), k, 0 );
+	return (0==id) ? 1 : id;
+}
+
+/*
+	a private copy of the dictionary given to open, blocks are
+	primed with it on both sides
+*/
+struct lz4f_dict_s
+{
+	char* p;
+	int n;
+	unsigned int id;	// 0 when there is no dictionary
 
-	void init(const char m, const int cl )
+	lz4f_dict_s():p(NULL),n(0),id(0)
 	{
-		complvl = cl;
-		fmode=m;
-		c.init('c',m);
-		d.init('d',m);
 	}
 
-	lz4f_error_t flush( FILE* fp )
+	~lz4f_dict_s()
 	{
-		return ('w'==fmode) ? push_w(fp) : lz4f_ok;
+		delete [] p;
 	}
 
-	lz4f_error_t push_w( FILE* fp )
+	bool set( const void* pd, const size_t nd )
 	{
-		size_t ibytes = d._bufi - d._buf0;
-		if(0>=ibytes)
-			return lz4f_ok;
-		assert( BUFSIZE >= ibytes );
-		int iresult = LZ4_compress_HC
-		(
-			 (const char*) d._buf0
-			,(char*) c._buf0
-			,(int) ibytes
-			,BUFSIZE*3/2
-			,complvl
-		);
-		if(0>=iresult)
-			return lz4f_fail_compress;
-		size_t obytes = iresult;
-		lz4f_sizes_s zz;
-		zz.d_size = (int)ibytes;
-		zz.c_size = (int)obytes;
-		unsigned char* pwbuf = c._buf0;
-		if(obytes > BUFSIZE)
-		{
-			// special case where compression increases size
-			pwbuf = d._buf0;
-			obytes = ibytes;
-			zz.d_size = (int)ibytes;
-			zz.c_size = (int)ibytes;
-#define NCBIT 0x80000000
-			// set the not-compressed bit
-			zz.c_size |= NCBIT; 
-		}
-		if(1!=fwrite( &zz,sizeof(zz),1,fp ))
-			return lz4f_fail_write;
-		if(1!=fwrite( pwbuf, obytes, 1, fp ))
-			return lz4f_fail_write;
-		d._bufi=d._buf0;
-		return lz4f_ok;
+		if(NULL==pd)
+			return true;
+		size_t k = std::min( nd, (size_t)64*1024 );
+		p = new char[ std::max( k, (size_t)1 ) ];
+		if(NULL==p)
+			return false;
+		memcpy( p, (const char*)pd + (nd - k), k );
+		n = (int)k;
+		id = lz4f_dict_id( pd, nd );
+		return true;
 	}
+};
+
+/*
+	compression levels as stored in lz4f_buffers_s::complvl
+
+	a positive level selects LZ4_compress_HC at that level
+	a level of zero or below selects LZ4_compress_fast with an
+	acceleration of -complvl where 0 and -1 are both the default
+*/
+#define LZ4F_LEVEL_MIN_HC	3	// "w0" to "w2" use the fast compressor
+#define LZ4F_LEVEL_MAX_HC	16	// matches g_maxCompressionLevel in lz4hc
+
+/*
+	lz4f_cstate_s
+
+	Compression state owned by one writer, a handle or a pool worker,
+	and reused for every block it compresses.
 
-	lz4f_error_t pull_r( FILE* fp )
+	Blocks stay independent.  For high compression, before each block
+	the previous one is dropped from the window with a zero byte save
+	of the dictionary, which moves the index base past every entry
+	already in the tables so stale entries can no longer match.  The
+	256KB of tables are therefore only cleared when the state is first
+	used, and again by the lz4 streaming code itself when the indexes
+	approach overflow, rather than once per block on the stack as
+	LZ4_compress_HC does.
+
+	The fast compressor keeps using LZ4_compress_fast_extState, which
+	clears its 16KB table per block but can then use the denser 16 bit
+	table for blocks below 64KB and so compresses better than the
+	streaming variant.  The state lives here instead of on the stack.
+
+	Linked blocks are copied into ring right behind the input before
+	them, so lz4 sees 64KB of history in one piece whatever the block
+	size.  When a block no longer fits, the last 64KB are moved to the
+	front with a dictionary save, as lz4frame does.
+
+	Independent blocks primed with a dictionary start from a copy of
+	a state that indexed the dictionary once, in init, instead of
+	clearing the tables and indexing it again for every block.
+*/
+struct lz4f_cstate_s
+{
+	LZ4_streamHC_t*	hc;			// high compression state
+	LZ4_stream_t*	fc;			// fast compression state
+	LZ4_streamHC_t*	hc0;		// hc as primed with the dictionary
+	LZ4_stream_t*	fc0;		// fc as primed with the dictionary
+	int				complvl;	// compression level
+	bool			used;		// a block has been compressed
+	char			nodict[8];	// target of the zero byte dictionary save
+	bool			linked;		// blocks refer to the input before them
+	char*			ring;		// 64KB of history then the linked blocks
+	size_t			ringsize;	// capacity of ring
+	size_t			ringpos;	// end of the input in ring
+	const lz4f_dict_s*	prime;	// dictionary each frame starts from or NULL
+
+	lz4f_cstate_s():hc(NULL),fc(NULL),hc0(NULL),fc0(NULL),complvl(0),used(false),linked(false),ring(NULL),ringsize(0),ringpos(0),prime(NULL)
 	{
-		lz4f_sizes_s zz;
-		if(1!=fread( &zz,sizeof(zz),1,fp ))
-			return lz4f_fail_read;
+	}
+
+	~lz4f_cstate_s()
+	{
+		if(NULL!=hc)
+			LZ4_freeStreamHC(hc);
+		if(NULL!=fc)
+			LZ4_freeStream(fc);
+		if(NULL!=hc0)
+			LZ4_freeStreamHC(hc0);
+		if(NULL!=fc0)
+			LZ4_freeStream(fc0);
+		delete [] ring;
+	}
 
-		if(0 == (zz.c_size & NCBIT))
+	/*
+		bs is the largest block that will be compressed, which sizes
+		the ring when blocks are linked
+	*/
+	bool init( const int cl, const bool link, const size_t bs, const lz4f_dict_s* pd )
+	{
+		complvl = cl;
+		used = false;
+		prime = pd;
+		linked = link;
+		ringpos = 0;
+		if(linked && ringsize < 64*1024 + bs)
 		{
-			// normal case is compressed
-			if(1!=fread( c._buf0, zz.c_size, 1, fp ))
-				return lz4f_fail_read;
-			int result = LZ4_decompress_fast
-			(
-				 (const char*) c._buf0
-				,(char*) d._buf0
-				,(int) zz.d_size
-			);
-			if(0>=result)
-				return lz4f_fail_decompress;
-			if(result != zz.c_size)
-				return lz4f_fail_decompress;
+			delete [] ring;
+			ringsize = 64*1024 + bs;
+			ring = new char[ ringsize ];
+			if(NULL==ring)
+			{
+				ringsize = 0;
+				return false;
+			}
+		}
+		// linked blocks follow the dictionary in ring from the first block on
+		if(linked && NULL!=prime)
+		{
+			memcpy( ring, prime->p, prime->n );
+			ringpos = prime->n;
+		}
+		if(0 < complvl)
+		{
+			if(NULL==hc)
+				hc = LZ4_createStreamHC();
+			if(NULL==hc)
+				return false;
+			LZ4_resetStreamHC(hc,complvl);
+			if(linked && NULL!=prime)
+				LZ4_loadDictHC(hc,ring,(int)ringpos);
+			if(!linked && NULL!=prime)
+			{
+				if(NULL==hc0)
+					hc0 = LZ4_createStreamHC();
+				if(NULL==hc0)
+					return false;
+				LZ4_resetStreamHC(hc0,complvl);
+				LZ4_loadDictHC(hc0,prime->p,prime->n);
+			}
 		}
 		else
 		{
-			// special case is not compressed
-			zz.c_size &= (~NCBIT);
-			if( zz.c_size != zz.d_size )
-				return lz4f_bad_frame;
-			if(1!=fread( d._buf0, zz.c_size, 1, fp ))
-				return lz4f_fail_read;
+			if(NULL==fc)
+				fc = LZ4_createStream();
+			if(NULL==fc)
+				return false;
+			if(linked)
+				LZ4_resetStream(fc);
+			if(linked && NULL!=prime)
+				LZ4_loadDict(fc,ring,(int)ringpos);
+			if(!linked && NULL!=prime)
+			{
+				if(NULL==fc0)
+					fc0 = LZ4_createStream();
+				if(NULL==fc0)
+					return false;
+				LZ4_resetStream(fc0);
+				LZ4_loadDict(fc0,prime->p,prime->n);
+			}
 		}
+		return true;
+	}
 
-		d._bufi = d._buf0;
-		d._bufz = d._buf0 + zz.d_size;
-		return lz4f_ok;
+	/*
+		compress one block
+		returns the compressed size or 0 on failure
+	*/
+	int compress( const char* src, char* dst, const int srcSize, const int maxDstSize )
+	{
+		if(linked)
+			return compress_linked( src, dst, srcSize, maxDstSize );
+		if(NULL!=prime)
+			return compress_primed( src, dst, srcSize, maxDstSize );
+		if(0 < complvl)
+		{
+			if(used)
+				LZ4_saveDictHC(hc,nodict,0);
+			used = true;
+			return LZ4_compress_HC_continue(hc,src,dst,srcSize,maxDstSize);
+		}
+		return LZ4_compress_fast_extState(fc,src,dst,srcSize,maxDstSize,-complvl);
 	}
 
-	size_t write( FILE* fp, const unsigned char* pbytes, const size_t nbytes )
+	/*
+		compress one independent block against the dictionary from a
+		copy of the primed state, which still points at prime->p
+	*/
+	int compress_primed( const char* src, char* dst, const int srcSize, const int maxDstSize )
 	{
-		unsigned char* pfr = (unsigned char*)pbytes;
-		unsigned char* pto = pfr + nbytes;
-		while(pfr < pto)
+		if(0 < complvl)
 		{
-			if(0==d.remaining())
-			{
-				lz4f_error_t e = push_w(fp);
-				if(lz4f_ok != e)
-				{
-					lz4ferr = e;
-					return 0;
-				}
-			}
-			pfr += d.write(pfr,pto-pfr);
+			memcpy( hc, hc0, sizeof(LZ4_streamHC_t) );
+			return LZ4_compress_HC_continue(hc,src,dst,srcSize,maxDstSize);
 		}
-		lz4ferr = lz4f_ok;
-		return pfr-pbytes;
+		memcpy( fc, fc0, sizeof(LZ4_stream_t) );
+		return LZ4_compress_fast_continue(fc,src,dst,srcSize,maxDstSize,-complvl);
 	}
 
-	size_t read( FILE* fp, unsigned char* pbytes, const size_t nbytes )
+	/*
+		compress one block that may refer to the previous 64KB of input
+		which is kept in ring because the caller reuses src
+	*/
+	int compress_linked( const char* src, char* dst, const int srcSize, const int maxDstSize )
 	{
-		unsigned char* pfr = (unsigned char*)pbytes;
-		unsigned char* pto = pfr + nbytes;
-		while(pfr < pto)
+		if(ringpos + srcSize > ringsize)
 		{
-			if(0==d.remaining())
-			{
-				lz4f_error_t e = pull_r(fp);
-				if(lz4f_ok != e)
-				{
-					lz4ferr = e;
-					break;
-				}
+			ringpos = (0 < complvl)
+				? LZ4_saveDictHC(hc,ring,64*1024)
+				: LZ4_saveDict(fc,ring,64*1024);
+		}
+		char* p = ring + ringpos;
+		memcpy( p, src, srcSize );
+		ringpos += srcSize;
+		if(0 < complvl)
+			return LZ4_compress_HC_continue(hc,p,dst,srcSize,maxDstSize);
+		return LZ4_compress_fast_continue(fc,p,dst,srcSize,maxDstSize,-complvl);
+	}
+};
+
+/*
+	compress ibytes at src into c and describe the result in zz
+
+	pwbuf receives the payload to write after zz which is normally
+	c._buf0 but is src when compression did not reduce the size
+	in which case the not-compressed bit is set in zz.c_size
+*/
+lz4f_error_t lz4f_compress_span
+(
+	 unsigned char* src
+	,const size_t ibytes
+	,lz4fbuf_s& c
+	,lz4f_cstate_s& cs
+	,lz4f_sizes_s& zz
+	,unsigned char*& pwbuf
+)
+{
+	int iresult = cs.compress
+	(
+		 (const char*) src
+		,(char*) c._buf0
+		,(int) ibytes
+		,(int) c._size
+	);
+	if(0>=iresult)
+		return lz4f_fail_compress;
+	size_t obytes = iresult;
+	zz.d_size = (int)ibytes;
+	zz.c_size = (int)obytes;
+	pwbuf = c._buf0;
+	if(obytes >= ibytes && !cs.linked)
+	{
+		// special case where compression increases size
+		pwbuf = src;
+		zz.d_size = (int)ibytes;
+		zz.c_size = (int)ibytes;
+		// set the not-compressed bit
+		zz.c_size |= NCBIT; 
+	}
+	return lz4f_ok;
+}
+
+/*
+	compress the filled part of d into c, see lz4f_compress_span
+*/
+lz4f_error_t lz4f_compress_block
+(
+	 lz4fbuf_s& d
+	,lz4fbuf_s& c
+	,lz4f_cstate_s& cs
+	,lz4f_sizes_s& zz
+	,unsigned char*& pwbuf
+)
+{
+	size_t ibytes = d._bufi - d._buf0;
+	assert( d._size >= ibytes );
+	return lz4f_compress_span( d._buf0, ibytes, c, cs, zz, pwbuf );
+}
+
+/*
+	lz4f_index_s
+
+	Writers note where every block starts, in the file and in the
+	uncompressed content, and lz4close appends the list after the
+	end mark:
+
+		lz4f_index_entry_s	entry[count]
+		lz4f_index_tail_s	tail
+
+	Readers look for the tail at the very end of the file.  A file
+	without an index ends in the zero end mark, which never matches
+	the tail signature, and readers that stop at the end mark never
+	see the index at all.
+*/
+#pragma pack(push,4)
+struct lz4f_index_entry_s
+{
+	unsigned long long	c_offset;	// file offset of the block header
+	unsigned long long	d_offset;	// uncompressed offset of the block
+};
+struct lz4f_index_tail_s
+{
+	unsigned long long	count;	// number of entries
+	unsigned long long	d_next;	// uncompressed size of all blocks
+	char	chL;	// signature 'L' hex 0x4C
+	char	chZ;	// signature 'Z' hex 0x5A
+	char	ch4;	// signature '4' hex 0x34
+	char	chx;	// signature 'x' hex 0x78
+	unsigned int	hc;		// HC byte of the final header
+};
+#pragma pack(pop)
+
+struct lz4f_index_s
+{
+	lz4f_index_entry_s*	pe;		// entries
+	size_t				count;	// entries in use
+	size_t				size;	// capacity of pe
+	unsigned long long	c_next;	// file offset of the next block
+	unsigned long long	d_next;	// uncompressed offset of the next block
+								// or the end of the last one when read
+	bool				loaded;	// a reader has looked for the index
+	bool				present;	// the file has an index
+	bool				several;	// the index is of the last of several frames
+	unsigned int		hc;		// HC byte of the final header when read
+	std::mutex			m;		// serialises the first load
+
+	lz4f_index_s():pe(NULL),count(0),size(0),c_next(0),d_next(0),loaded(false),present(false),several(false),hc(0)
+	{
+	}
+
+	~lz4f_index_s()
+	{
+		delete [] pe;
+	}
+
+	bool reserve( const size_t n )
+	{
+		if(n <= size)
+			return true;
+		lz4f_index_entry_s* p = new lz4f_index_entry_s[n];
+		if(NULL==p)
+			return false;
+		if(0<count)
+			memcpy( p, pe, count*sizeof(*pe) );
+		delete [] pe;
+		pe = p;
+		size = n;
+		return true;
+	}
+
+	// note the block just written at c_next
+	bool add( const lz4f_sizes_s& zz )
+	{
+		if(count==size && !reserve( std::max( 2*size, (size_t)256 ) ))
+			return false;
+		pe[count].c_offset = c_next;
+		pe[count].d_offset = d_next;
+		++count;
+		c_next += sizeof(zz) + (zz.c_size & (~NCBIT));
+		d_next += zz.d_size;
+		return true;
+	}
+
+	// append the entries and the tail at the current position of fp
+	lz4f_error_t write( lz4f_io_s* fp, const unsigned char hcfinal ) const
+	{
+		lz4f_index_tail_s t;
+		t.count = count;
+		t.d_next = d_next;
+		t.chL = 'L';
+		t.chZ = 'Z';
+		t.ch4 = '4';
+		t.chx = 'x';
+		t.hc = hcfinal;
+		if(0<count && count!=fp->write( pe, sizeof(*pe), count ))
+			return lz4f_fail_write;
+		if(1!=fp->write( &t, sizeof(t), 1 ))
+			return lz4f_fail_write;
+		return lz4f_ok;
+	}
+
+	/*
+		read the index from the end of fp once if there is one
+		a missing or damaged index leaves present false
+		positional reads leave the position of fp alone, so this
+		is safe next to a reader thread and from many callers
+
+		a file that was appended to or concatenated ends with the
+		index of its last frame only, which does not run from the
+		first block at cfirst to the end mark before the entries,
+		so it is not used and several is set instead
+	*/
+	void load( lz4f_io_s* fp, const unsigned long long cfirst )
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if(loaded)
+			return;
+		long long z = fp->size();
+		lz4f_index_tail_s t;
+		if(true
+			&& (long long)sizeof(t) <= z
+			&& fp->read_at( &t, sizeof(t), z - sizeof(t) )
+			&& 'L' == t.chL
+			&& 'Z' == t.chZ
+			&& '4' == t.ch4
+			&& 'x' == t.chx
+			&& t.count <= (unsigned long long)(z - sizeof(t)) / sizeof(*pe)
+			&& reserve( (size_t)t.count )
+			&& fp->read_at( pe, (size_t)t.count*sizeof(*pe), z - sizeof(t) - t.count*sizeof(*pe) )
+		)
+		{
+			count = (size_t)t.count;
+			d_next = t.d_next;
+			hc = t.hc;
+			present = spans( fp, cfirst, z - sizeof(t) - count*sizeof(*pe) );
+			several = !present;
+		}
+		loaded = true;
+	}
+
+	// the entries cover the blocks from cfirst to the end mark at cend
+	bool spans( lz4f_io_s* fp, const unsigned long long cfirst, const unsigned long long cend ) const
+	{
+		lz4f_sizes_s zz;
+		if(0==count)
+			return cfirst + sizeof(zz) == cend;
+		const lz4f_index_entry_s& e = pe[count-1];
+		return(true
+			&& cfirst == pe[0].c_offset
+			&& 0 == pe[0].d_offset
+			&& fp->read_at( &zz, sizeof(zz), e.c_offset )
+			&& 0 < zz.d_size
+			&& e.d_offset + zz.d_size == d_next
+			&& e.c_offset + 2*sizeof(zz) + (zz.c_size & (~NCBIT)) == cend
+		);
+	}
+
+	// the entry of the block holding uncompressed offset off
+	const lz4f_index_entry_s* find( const unsigned long long off ) const
+	{
+		size_t lo = 0;
+		size_t hi = count;
+		while(1 < hi - lo)
+		{
+			size_t mid = lo + (hi - lo)/2;
+			if(pe[mid].d_offset <= off)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		return pe + lo;
+	}
+};
+
+lz4f_error_t lz4f_write_block( lz4f_io_s* fp, const lz4f_sizes_s& zz, const unsigned char* pwbuf, lz4f_index_s& ix )
+{
+	size_t obytes = zz.c_size & (~NCBIT);
+	if(!fp->write2( &zz, sizeof(zz), pwbuf, obytes ))
+		return lz4f_fail_write;
+	if(!ix.add(zz))
+		return lz4f_fail_heap;
+	return lz4f_ok;
+}
+
+/*
+	read the next block header into zz and its payload into c
+	or straight to pd when the block is stored not-compressed
+	pd has room for dmax bytes
+
+	the end mark is returned as lz4f_ok with zz.d_size == 0
+*/
+lz4f_error_t lz4f_fetch_block
+(
+	 lz4f_io_s* fp
+	,lz4f_sizes_s& zz
+	,lz4fbuf_s& c
+	,unsigned char* pd
+	,const size_t dmax
+)
+{
+	if(1!=fp->read( &zz,sizeof(zz),1 ))
+		return lz4f_fail_read;
+
+	if(0 == zz.d_size && 0 == zz.c_size)
+		return lz4f_ok;
+
+	if(0 >= zz.d_size || dmax < (size_t)zz.d_size)
+		return lz4f_bad_frame;
+
+	if(0 == (zz.c_size & NCBIT))
+	{
+		// normal case is compressed
+		if(0 >= zz.c_size || c._size < (size_t)zz.c_size)
+			return lz4f_bad_frame;
+		if((size_t)zz.c_size != fp->read_ahead( c._buf0, zz.c_size, sizeof(zz) ))
+			return lz4f_fail_read;
+	}
+	else
+	{
+		// special case is not compressed
+		if( (int)(zz.c_size & (~NCBIT)) != zz.d_size )
+			return lz4f_bad_frame;
+		if((size_t)zz.d_size != fp->read_ahead( pd, zz.d_size, sizeof(zz) ))
+			return lz4f_fail_read;
+	}
+	return lz4f_ok;
+}
+
+/*
+	lz4f_fetch_block for the block whose header is at file offset
+	c_offset, read with positional reads that leave fp alone
+*/
+lz4f_error_t lz4f_fetch_block_at
+(
+	 lz4f_io_s* fp
+	,const unsigned long long c_offset
+	,lz4f_sizes_s& zz
+	,lz4fbuf_s& c
+	,unsigned char* pd
+	,const size_t dmax
+)
+{
+	if(!fp->read_at( &zz, sizeof(zz), c_offset ))
+		return lz4f_fail_read;
+
+	if(0 >= zz.d_size || dmax < (size_t)zz.d_size)
+		return lz4f_bad_frame;
+
+	if(0 == (zz.c_size & NCBIT))
+	{
+		if(0 >= zz.c_size || c._size < (size_t)zz.c_size)
+			return lz4f_bad_frame;
+		if(!fp->read_at( c._buf0, zz.c_size, c_offset + sizeof(zz) ))
+			return lz4f_fail_read;
+	}
+	else
+	{
+		if( (int)(zz.c_size & (~NCBIT)) != zz.d_size )
+			return lz4f_bad_frame;
+		if(!fp->read_at( pd, zz.d_size, c_offset + sizeof(zz) ))
+			return lz4f_fail_read;
+	}
+	return lz4f_ok;
+}
+
+/*
+	lz4f_fetch_block for a file mapped at map, the block at mpos is
+	left in place, pc receives its payload and mpos moves past it
+*/
+lz4f_error_t lz4f_map_block
+(
+	 const unsigned char* map
+	,const size_t mapsize
+	,size_t& mpos
+	,lz4f_sizes_s& zz
+	,const unsigned char*& pc
+	,const size_t dmax
+)
+{
+	if(mapsize - mpos < sizeof(zz))
+		return lz4f_fail_read;
+	memcpy( &zz, map + mpos, sizeof(zz) );
+	mpos += sizeof(zz);
+
+	if(0 == zz.d_size && 0 == zz.c_size)
+		return lz4f_ok;
+
+	if(0 >= zz.d_size || dmax < (size_t)zz.d_size)
+		return lz4f_bad_frame;
+
+	size_t n = zz.d_size;
+	if(0 == (zz.c_size & NCBIT))
+	{
+		if(0 >= zz.c_size)
+			return lz4f_bad_frame;
+		n = zz.c_size;
+	}
+	else
+	if( (int)(zz.c_size & (~NCBIT)) != zz.d_size )
+		return lz4f_bad_frame;
+	if(mapsize - mpos < n)
+		return lz4f_fail_read;
+	pc = map + mpos;
+	mpos += n;
+	return lz4f_ok;
+}
+
+/*
+	decompress a block fetched by lz4f_fetch_block from pc to pd
+
+	linked blocks are decoded through sd which must be given the
+	blocks in order, independent blocks pass sd as NULL and are
+	decoded against prime when it is not NULL
+
+	pc may lie in a file mapping so decoding never reads past
+	zz.c_size bytes
+*/
+lz4f_error_t lz4f_decode_span
+(
+	 const lz4f_sizes_s& zz
+	,const unsigned char* pc
+	,unsigned char* pd
+	,LZ4_streamDecode_t* sd
+	,const lz4f_dict_s* prime
+)
+{
+	if(0 < zz.d_size && NULL != sd)
+	{
+		// the linked writer never stores blocks not-compressed
+		if(0 != (zz.c_size & NCBIT))
+			return lz4f_bad_frame;
+		int result = LZ4_decompress_safe_continue
+		(
+			 sd
+			,(const char*) pc
+			,(char*) pd
+			,(int) zz.c_size
+			,(int) zz.d_size
+		);
+		if(result != zz.d_size)
+			return lz4f_fail_decompress;
+	}
+	else
+	if(0 < zz.d_size && 0 == (zz.c_size & NCBIT))
+	{
+		int result = (NULL != prime)
+			? LZ4_decompress_safe_usingDict
+			(
+				 (const char*) pc
+				,(char*) pd
+				,(int) zz.c_size
+				,(int) zz.d_size
+				,prime->p
+				,prime->n
+			)
+			: LZ4_decompress_safe
+			(
+				 (const char*) pc
+				,(char*) pd
+				,(int) zz.c_size
+				,(int) zz.d_size
+			);
+		if(result != zz.d_size)
+			return lz4f_fail_decompress;
+	}
+	return lz4f_ok;
+}
+
+/*
+	decompress a block to pd inside d, see lz4f_decode_span,
+	and leave d holding exactly the decompressed bytes
+*/
+lz4f_error_t lz4f_decode_block
+(
+	 const lz4f_sizes_s& zz
+	,lz4fbuf_s& c
+	,lz4fbuf_s& d
+	,unsigned char* pd
+	,LZ4_streamDecode_t* sd
+	,const lz4f_dict_s* prime
+)
+{
+	lz4f_error_t e = lz4f_decode_span( zz, c._buf0, pd, sd, prime );
+	if(lz4f_ok != e)
+		return e;
+	d._bufi = pd;
+	d._bufz = pd + zz.d_size;
+	return lz4f_ok;
+}
+
+/*
+	one block in flight through a worker pool
+*/
+struct lz4f_slot_s
+{
+	lz4fbuf_s		c;		// compressed
+	lz4fbuf_s		d;		// decompressed
+	lz4f_sizes_s	zz;		// block sizes as framed
+	unsigned char*	pwbuf;	// payload to write after zz
+	lz4f_error_t	e;		// worker result
+	bool			done;	// worker is finished with the slot
+};
+
+/*
+	lz4f_pool_s
+
+	A ring of slots served by a set of worker threads.
+
+	In 'w' mode the caller swaps each filled d buffer into the next
+	free slot, the workers compress slots in any order and the caller
+	retires them strictly in sequence by writing them to the file.
+	The file is only ever touched by the calling thread.
+
+	In 'r' mode the workers read ahead.  A worker holds mio while it
+	claims the next sequence and reads that block from the file, so
+	blocks are fetched in file order, then it decompresses outside
+	the lock while the next worker fetches.  The caller takes slots
+	strictly in sequence by swapping the decoded d buffer out.
+	The file is only ever touched by the workers.
+
+	Sequence numbers only grow and slot = sequence % ns, so
+		s_done <= s_work <= s_next
+	and s_next - s_done never exceeds ns.
+*/
+struct lz4f_pool_s
+{
+	std::mutex				m;
+	std::mutex				mio;		// serialises reads of fp
+	std::condition_variable	cv_work;	// wakes workers
+	std::condition_variable	cv_done;	// wakes the caller
+	std::thread*			pt;			// worker threads
+	int						nt;			// number of worker threads
+	lz4f_slot_s*			ps;			// ring of slots
+	int						ns;			// number of slots
+	unsigned long long		s_next;		// next sequence to submit
+	unsigned long long		s_work;		// next sequence for a worker
+	unsigned long long		s_done;		// oldest sequence not retired
+	int						complvl;	// compression level
+	lz4f_io_s*				fp;			// file read by the workers
+	const lz4f_dict_s*		prime;		// dictionary of the frame or NULL
+	bool					ended;		// end mark or error was fetched
+	bool					paused;		// readers must not touch fp
+	bool					quit;		// workers must exit
+
+	lz4f_pool_s():pt(NULL),nt(0),ps(NULL),ns(0),s_next(0),s_work(0),s_done(0),complvl(0),fp(NULL),prime(NULL),ended(false),paused(false),quit(false)
+	{
+	}
+
+	bool start( const int threads, const char fmode, const int cl, const size_t bsize, lz4f_io_s* f, const lz4f_dict_s* pd )
+	{
+		complvl = cl;
+		fp = f;
+		prime = pd;
+		ns = 2*threads;
+		ps = new lz4f_slot_s[ns];
+		pt = new std::thread[threads];
+		if(NULL==ps || NULL==pt)
+			return false;
+		for(int i=0; i<ns; ++i)
+		{
+			if(!lz4f_alloc_block( ps[i].c, ps[i].d, bsize, fmode ))
+				return false;
+			ps[i].done = false;
+		}
+		for(nt=0; nt<threads; ++nt)
+		{
+			try
+			{
+				pt[nt] = ('w'==fmode)
+					? std::thread( &lz4f_pool_s::work_w, this )
+					: std::thread( &lz4f_pool_s::work_r, this );
+			}
+			catch(...)
+			{
+				break;
 			}
-			pfr += d.read(pfr,pto-pfr);
 		}
-		return pfr-pbytes;
+		return 0<nt;
 	}
 
-	size_t gets( FILE* fp, char* pbytes, const size_t nbytes )
+	~lz4f_pool_s()
 	{
-		char* pfr = (char*)pbytes;
-		char* pto = pfr + nbytes;
-		while(pfr < pto)
 		{
-			if(0==d.remaining())
+			std::lock_guard<std::mutex> lock(m);
+			quit = true;
+		}
+		cv_work.notify_all();
+		for(int i=0; i<nt; ++i)
+			pt[i].join();
+		delete [] pt;
+		delete [] ps;
+	}
+
+	void work_w()
+	{
+		lz4f_cstate_s cs;
+		bool ready = cs.init(complvl,false,0,prime);
+		for(;;)
+		{
+			lz4f_slot_s* p;
 			{
-				lz4f_error_t e = pull_r(fp);
-				if(lz4f_ok != e)
+				std::unique_lock<std::mutex> lock(m);
+				while(!quit && s_work==s_next)
+					cv_work.wait(lock);
+				if(s_work==s_next)
+					return;
+				p = ps + (s_work++ % ns);
+			}
+			lz4f_error_t e = ready
+				? lz4f_compress_block( p->d, p->c, cs, p->zz, p->pwbuf )
+				: lz4f_fail_heap;
+			{
+				std::lock_guard<std::mutex> lock(m);
+				p->e = e;
+				p->done = true;
+			}
+			cv_done.notify_one();
+		}
+	}
+
+	void work_r()
+	{
+		for(;;)
+		{
+			lz4f_slot_s* p;
+			lz4f_error_t e;
+			{
+				std::lock_guard<std::mutex> lockio(mio);
 				{
-					lz4ferr = e;
-					return 0;
+					std::unique_lock<std::mutex> lock(m);
+					while(!quit && (ended || paused || (s_next - s_done) == (unsigned long long)ns))
+						cv_work.wait(lock);
+					if(quit)
+						return;
+					p = ps + (s_next++ % ns);
+				}
+				e = lz4f_fetch_block( fp, p->zz, p->c, p->d._buf0, p->d._size );
+				if(lz4f_ok != e || 0 == p->zz.d_size)
+				{
+					std::lock_guard<std::mutex> lock(m);
+					ended = true;
 				}
 			}
-			pfr += d.gets(pfr,pto-pfr);
-			if(pfr>pbytes)
+			if(lz4f_ok == e)
+				e = lz4f_decode_block( p->zz, p->c, p->d, p->d._buf0, NULL, prime );
 			{
-				if(0==pfr[0])
-				if('\n'==pfr[-1])
-					break;
+				std::lock_guard<std::mutex> lock(m);
+				p->e = e;
+				p->done = true;
 			}
+			cv_done.notify_one();
 		}
-		lz4ferr = lz4f_ok;
-		return pfr-pbytes;
 	}
-};
 
-int lz4eof		( lz4File f )
-{
-	if(NULL==f)
+	/*
+		swap the next decoded block in sequence into d
+		the end mark leaves d empty and sets eof
+	*/
+	lz4f_error_t pull_r( lz4fbuf_s& d, bool& eof )
 	{
-		return lz4ferr = lz4f_bad_arg;
+		lz4f_slot_s* p = ps + (s_done % ns);
+		lz4f_error_t e;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			while(!p->done)
+				cv_done.wait(lock);
+			e = p->e;
+			if(lz4f_ok == e)
+				p->d.swap(d);
+			if(lz4f_ok != e || 0 == p->zz.d_size)
+				eof = true;
+			p->done = false;
+			++s_done;
+		}
+		cv_work.notify_one();
+		return e;
 	}
-	return feof(f->fp);
-}
 
-int lz4close	( lz4File f )
-{
-	if(NULL==f)
+	/*
+		stop the readers between blocks so the caller may use fp
+		every block already claimed is fetched and decoded first
+	*/
+	void pause()
 	{
-		return lz4ferr = lz4f_bad_arg;
+		std::unique_lock<std::mutex> lock(m);
+		paused = true;
+		for(unsigned long long s=s_done; s<s_next; ++s)
+		{
+			lz4f_slot_s* p = ps + (s % ns);
+			while(!p->done)
+				cv_done.wait(lock);
+		}
 	}
-	if(NULL==f->fp)
+
+	/*
+		let the readers go on, when discard is true the blocks read
+		ahead are dropped and reading restarts where fp is now
+	*/
+	void resume( const bool discard )
 	{
-		return lz4ferr = lz4f_bad_arg;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			if(discard)
+			{
+				for(; s_done<s_next; ++s_done)
+					ps[s_done % ns].done = false;
+				ended = false;
+			}
+			paused = false;
+		}
+		cv_work.notify_all();
 	}
 
-	if('w'==f->pb->fmode)
+	/*
+		write finished slots to the file in sequence
+		when wait is false stop at the first unfinished slot
+		when wait is true retire at least one slot if any are in flight
+	*/
+	lz4f_error_t retire( lz4f_io_s* fp, bool wait, lz4f_index_s& ix )
 	{
-
-		lz4ferr = f->pb->flush(f->fp);
-
-		if(lz4ferr == lz4f_ok)
+		while(s_done < s_next)
 		{
-			unsigned int zero=0;
-			size_t result = fwrite(&zero,4,2,f->fp);
-			if(2!=result)
+			lz4f_slot_s* p = ps + (s_done % ns);
 			{
-				lz4ferr = lz4f_fail_write;
+				std::unique_lock<std::mutex> lock(m);
+				if(!p->done && !wait)
+					break;
+				while(!p->done)
+					cv_done.wait(lock);
 			}
+			wait = false;
+			++s_done;
+			if(lz4f_ok != p->e)
+				return p->e;
+			lz4f_error_t e = lz4f_write_block( fp, p->zz, p->pwbuf, ix );
+			if(lz4f_ok != e)
+				return e;
 		}
+		return lz4f_ok;
+	}
 
-		if(lz4ferr == lz4f_ok)
+	/*
+		hand the filled buffer d to the workers
+		d is swapped with the empty buffer of a free slot
+	*/
+	lz4f_error_t push_w( lz4f_io_s* fp, lz4fbuf_s& d, lz4f_index_s& ix )
+	{
+		lz4f_error_t e = retire( fp, (s_next - s_done) == (unsigned long long)ns, ix );
+		if(lz4f_ok != e)
+			return e;
+		lz4f_slot_s* p = ps + (s_next % ns);
 		{
-			f->h.lz4c.c_size = (0<f->h.lz4c.content_size) ? 1 : 0;
-			size_t zz = sizeof(f->h);
-			f->h.lz4c.hc = 0;
-			f->h.lz4c.hc = ((XXH32(&f->h,zz,0))>>8) & 0xff;
+			std::lock_guard<std::mutex> lock(m);
+			p->d.swap(d);
+			p->done = false;
+			p->e = lz4f_ok;
+			++s_next;
+		}
+		cv_work.notify_one();
+		d._bufi = d._buf0;
+		return lz4f_ok;
+	}
 
-			//write the final header
-			rewind(f->fp);
-			if(1!=fwrite(&(f->h),zz,1,f->fp))
-				lz4ferr = lz4f_fail_write;
+	lz4f_error_t drain( lz4f_io_s* fp, lz4f_index_s& ix )
+	{
+		while(s_done < s_next)
+		{
+			lz4f_error_t e = retire( fp, true, ix );
+			if(lz4f_ok != e)
+				return e;
 		}
+		return lz4f_ok;
+	}
+};
+
+/*
+	state of a standard lz4 frame as the lz4 tools write it,
+	used in place of the lz4f header, block headers and index
+*/
+struct lz4f_frame_s
+{
+	LZ4F_compressionContext_t cctx;
+	LZ4F_decompressionContext_t dctx;
+	LZ4F_preferences_t prefs;
+	size_t hint;	// input LZ4F_decompress wants next, 0 between frames
 
+	lz4f_frame_s():cctx(NULL),dctx(NULL),hint(0)
+	{
+		memset(&prefs,0,sizeof(prefs));
 	}
 
-	fclose(f->fp);
-	delete f;
-	return lz4ferr;
-}
+	~lz4f_frame_s()
+	{
+		if(NULL!=cctx)
+			LZ4F_freeCompressionContext(cctx);
+		if(NULL!=dctx)
+			LZ4F_freeDecompressionContext(dctx);
+	}
+};
 
-lz4File lz4open (const char * fname, const char * fmode)
+struct lz4f_buffers_s
 {
-	if(NULL==fname)
+	lz4fbuf_s	c;	// compressed
+	lz4fbuf_s	d;	// decompressed
+	int complvl;	// compression level
+	lz4f_cstate_s cs;	// compression state of the calling thread
+	char fmode;		// 'r' or 'w'
+	bool eof;		// end mark has been read
+	lz4f_pool_s* pool;	// worker threads or NULL
+	size_t bsize;	// block size
+	/*
+		Linked blocks are decoded into a ring inside d which keeps the
+		previous 64KB of output in place for the next block to refer to.
+		A block never starts less than 64KB + bsize past the start of
+		the history it needs, so the ring holds 64KB + 2*bsize and a
+		block wraps to the start when it would not fit at ringo.
+	*/
+	LZ4_streamDecode_t* sd;	// linked block decoder or NULL
+	size_t ringo;	// offset in d of the next linked block
+	size_t reserved;	// bytes at d._bufi handed out by reserve
+	char* line;		// side buffer for a line split across blocks
+	size_t linesize;	// capacity of line
+	lz4f_index_s ix;	// block index written or read
+	unsigned long long cfirst;	// file offset of the first block
+	unsigned long long pos;	// uncompressed offset of the end of d
+	const unsigned char* map;	// the whole file when mapped or NULL
+	size_t mapsize;	// bytes at map
+	size_t mpos;	// offset in map of the next block
+	lz4f_frame_s* frame;	// standard frame state or NULL
+	bool plain;		// the input is not compressed and read as it is
+	unsigned long long nblocks;	// blocks read since the header of this frame
+	size_t bsize0;	// block size of the first frame
+	bool linked0;	// the first frame has linked blocks
+	lz4f_dict_s dict;	// dictionary given to open
+	unsigned int dictid;	// dictionary id of this frame, 0 for none
+	unsigned int dictid0;	// dictionary id of the first frame
+
+	lz4f_buffers_s():eof(false),pool(NULL),bsize(0),sd(NULL),ringo(0),reserved(0),line(NULL),linesize(0),cfirst(0),pos(0),map(NULL),mapsize(0),mpos(0),frame(NULL),plain(false),nblocks(0),bsize0(0),linked0(false),dictid(0),dictid0(0)
 	{
-		lz4ferr = lz4f_bad_arg;
-		return NULL;
 	}
 
-	if(NULL==fmode)
+	~lz4f_buffers_s()
+	{
+		delete [] line;
+		delete frame;
+		delete pool;
+		if(NULL!=sd)
+			LZ4_freeStreamDecode(sd);
+	}
+
+	lz4f_error_t init
+	(
+		 const char m
+		,const int cl
+		,const int threads
+		,const size_t bs
+		,const bool linked
+		,const bool mapped
+		,const bool framed
+		,const bool isplain
+		,const unsigned int id
+		,lz4f_io_s* fp
+	)
+	{
+		complvl = cl;
+		fmode=m;
+		bsize=bs;
+		dictid = dictid0 = id;
+		// a pipe has no position but the header and id are all before us
+		long long at = fp->tell();
+		cfirst = (0 <= at) ? at : sizeof(lz4f_header_s) + ((0!=id) ? sizeof(dictid) : 0);
+		ix.c_next = cfirst;
+		if(framed)
+			return init_frame(m,cl,linked,fp);
+		if('r'==m && mapped)
+		{
+			// a file that cannot be mapped is read through fp instead
+			map = fp->map(mapsize);
+			mpos = (size_t)cfirst;
+			if(NULL!=map && mapsize < mpos)
+				map = NULL;
+		}
+		if('r'==m && isplain)
+		{
+			plain = true;
+			if(!d.alloc( bsize ))
+				return lz4f_fail_heap;
+			d.init('d',m);
+			return lz4f_ok;
+		}
+		bsize0 = bsize;
+		linked0 = linked;
+		return setup(threads,linked,fp);
+	}
+
+	// the dictionary of a frame with dictionary id id, or NULL
+	const lz4f_dict_s* primer( const unsigned int id ) const
+	{
+		return (0!=id && id==dict.id) ? &dict : NULL;
+	}
+
+	// start linked decoding of a frame from its dictionary
+	void start_sd()
+	{
+		const lz4f_dict_s* pd = primer(dictid);
+		LZ4_setStreamDecode( sd, (NULL!=pd) ? pd->p : NULL, (NULL!=pd) ? pd->n : 0 );
+	}
+
+	// allocate the buffers and workers for blocks of bsize
+	lz4f_error_t setup( const int threads, const bool linked, lz4f_io_s* fp )
+	{
+		const char m = fmode;
+		if('r'==m && linked)
+		{
+			sd = LZ4_createStreamDecode();
+			if(NULL==sd)
+				return lz4f_fail_heap;
+			start_sd();
+			if(!c.alloc( LZ4_compressBound((int)bsize) ))
+				return lz4f_fail_heap;
+			if(!d.alloc( 64*1024 + 2*bsize ))
+				return lz4f_fail_heap;
+			c.init('c',m);
+			d.init('d',m);
+			return lz4f_ok;
+		}
+		if(!lz4f_alloc_block( c, d, bsize, m ))
+			return lz4f_fail_heap;
+		/*
+			a single reader thread still helps because it overlaps
+			file reads and decompression with the caller
+
+			linked blocks must be compressed and decoded in order
+			and always stay on the calling thread, as do blocks
+			decoded from a mapping
+		*/
+		if(!linked && NULL==map && (1<threads || (1==threads && 'r'==m)))
+		{
+			pool = new lz4f_pool_s;
+			if(NULL!=pool && !pool->start(threads,m,complvl,bsize,fp,primer(dictid)))
+			{
+				// run on the calling thread instead
+				delete pool;
+				pool = NULL;
+			}
+		}
+		if('w'==m && NULL==pool && !cs.init(complvl,linked,bsize,primer(dictid)))
+			return lz4f_fail_heap;
+		return lz4f_ok;
+	}
+
+	/*
+		set up again for a frame whose blocks differ from those of
+		the frame before it, such a frame is read on the calling
+		thread as the workers may not be stopped mid seek
+	*/
+	lz4f_error_t reset( const size_t bs, const bool linked, lz4f_io_s* fp )
+	{
+		delete pool;
+		pool = NULL;
+		if(NULL!=sd)
+			LZ4_freeStreamDecode(sd);
+		sd = NULL;
+		ringo = 0;
+		lz4fbuf_s c0;
+		lz4fbuf_s d0;
+		c.swap(c0);
+		d.swap(d0);
+		bsize = bs;
+		return setup(0,linked,fp);
+	}
+
+	// read n bytes at p, or step over them when p is NULL
+	unsigned long long take( lz4f_io_s* fp, void* p, const unsigned long long n )
+	{
+		if(NULL!=map)
+		{
+			size_t k = (size_t)std::min( n, (unsigned long long)(mapsize - mpos) );
+			if(NULL!=p)
+				memcpy( p, map + mpos, k );
+			mpos += k;
+			return k;
+		}
+		if(NULL!=p)
+			return fp->read( p, 1, (size_t)n );
+		unsigned long long done = 0;
+		while(done < n)
+		{
+			size_t k = fp->read( c._buf0, 1, (size_t)std::min( n - done, (unsigned long long)c._size ) );
+			if(0==k)
+				break;
+			done += k;
+		}
+		return done;
+	}
+
+	/*
+		after the end mark step over the index of the frame and
+		read the header of the next one, written by "a" or by
+		joining files, more is false when the input ends instead
+
+		a frame written before the index was added ends at the
+		end mark, so the next header may follow it right away, and
+		the 8 signature bytes of a header are looked at first, an
+		index starts with a count or an offset that cannot match
+	*/
+	lz4f_error_t next_frame( lz4f_io_s* fp, bool& more )
+	{
+		more = false;
+		lz4f_header_s h;
+		const unsigned long long zs = 8;
+		unsigned long long k = take( fp, &h, zs );
+		if(0==k)
+			return lz4f_ok;
+		if(zs != k || false == h.is_valid_header_signature())
+		{
+			// the bytes taken start the index, or its tail when empty
+			lz4f_index_tail_s t;
+			const unsigned long long ni = nblocks*sizeof(lz4f_index_entry_s);
+			if(0==ni)
+				memcpy( &t, &h, (size_t)k );
+			else
+			if(zs == k)
+				k += take( fp, NULL, ni - zs );
+			if(k >= ni)
+				k += take( fp, (char*)&t + (k - ni), sizeof(t) - (size_t)(k - ni) );
+			if(false
+				|| ni + sizeof(t) != k
+				|| 'L' != t.chL
+				|| 'Z' != t.chZ
+				|| '4' != t.ch4
+				|| 'x' != t.chx
+				|| nblocks != t.count
+			)
+				return lz4f_bad_frame;
+			k = take( fp, &h, zs );
+			if(0==k)
+				return lz4f_ok;
+		}
+		if(zs == k)
+			k += take( fp, (char*)&h + zs, sizeof(h) - zs );
+		if(sizeof(h) != k || false == h.is_valid_header_signature() || 0 == lz4f_block_size(h.lz4c.b_maxsize))
+			return lz4f_bad_header;
+		unsigned int id = 0;
+		if(0 != (h.lz4c.rffu & LZ4F_RFFU_DICT) && sizeof(id) != take( fp, &id, sizeof(id) ))
+			return lz4f_bad_header;
+		if(0!=id && NULL==primer(id))
+			return lz4f_bad_dict;
+		more = true;
+		nblocks = 0;
+		dictid = id;
+		const size_t bs = lz4f_block_size(h.lz4c.b_maxsize);
+		const bool linked = (0 == h.lz4c.b_independent);
+		if(bs != bsize || linked != (NULL!=sd))
+			return reset( bs, linked, fp );
+		// each frame starts without history but its dictionary
+		if(NULL!=sd)
+			start_sd();
+		ringo = 0;
+		if(NULL!=pool)
+		{
+			pool->prime = primer(dictid);
+			pool->resume(true);
+		}
+		return lz4f_ok;
+	}
+
+	/*
+		a standard frame is compressed and decoded on the calling
+		thread by lz4frame, c holds compressed bytes either way
+	*/
+	lz4f_error_t init_frame( const char m, const int cl, const bool linked, lz4f_io_s* fp )
+	{
+		frame = new lz4f_frame_s;
+		if(NULL==frame)
+			return lz4f_fail_heap;
+		if('r'==m)
+		{
+			if(LZ4F_isError( LZ4F_createDecompressionContext( &frame->dctx, LZ4F_VERSION ) ))
+				return lz4f_fail_heap;
+			if(!c.alloc( 64*1024 ) || !d.alloc( bsize ))
+				return lz4f_fail_heap;
+			c.init('c',m);
+			d.init('d',m);
+			// lz4open has already taken the magic number
+			static const unsigned char magic[4] = { 0x04, 0x22, 0x4D, 0x18 };
+			memcpy( c._buf0, magic, sizeof(magic) );
+			c._bufz = c._buf0 + sizeof(magic);
+			if(cfirst >= sizeof(magic))
+				cfirst -= sizeof(magic);
+			frame->hint = sizeof(magic);
+			return lz4f_ok;
+		}
+		if(LZ4F_isError( LZ4F_createCompressionContext( &frame->cctx, LZ4F_VERSION ) ))
+			return lz4f_fail_heap;
+		frame->prefs.frameInfo.blockSizeID =
+			 (64*1024 >= bsize) ? LZ4F_max64KB
+			:(256*1024 >= bsize) ? LZ4F_max256KB
+			:(1024*1024 >= bsize) ? LZ4F_max1MB
+			: LZ4F_max4MB;
+		frame->prefs.frameInfo.blockMode = linked ? LZ4F_blockLinked : LZ4F_blockIndependent;
+		frame->prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+		// this lz4frame has no acceleration, every fast level is 0
+		frame->prefs.compressionLevel = std::max( cl, 0 );
+		frame->prefs.autoFlush = 1;
+		// room for a block or the frame header of up to 15 bytes
+		if(!c.alloc( std::max( LZ4F_compressBound( bsize, &frame->prefs ), (size_t)64 ) ) || !d.alloc( bsize ))
+			return lz4f_fail_heap;
+		c.init('c',m);
+		d.init('d',m);
+		size_t n = LZ4F_compressBegin( frame->cctx, c._buf0, c._size, &frame->prefs );
+		if(LZ4F_isError(n))
+			return lz4f_fail_compress;
+		if(1!=fp->write( c._buf0, n, 1 ))
+			return lz4f_fail_write;
+		return lz4f_ok;
+	}
+
+	lz4f_error_t push_frame( lz4f_io_s* fp, const unsigned char* src, const size_t ibytes )
+	{
+		size_t n = LZ4F_compressUpdate( frame->cctx, c._buf0, c._size, src, ibytes, NULL );
+		if(LZ4F_isError(n))
+			return lz4f_fail_compress;
+		if(0<n && 1!=fp->write( c._buf0, n, 1 ))
+			return lz4f_fail_write;
+		return lz4f_ok;
+	}
+
+	// write the end mark and content checksum of the frame
+	lz4f_error_t end_frame( lz4f_io_s* fp )
+	{
+		size_t n = LZ4F_compressEnd( frame->cctx, c._buf0, c._size, NULL );
+		if(LZ4F_isError(n))
+			return lz4f_fail_compress;
+		if(0<n && 1!=fp->write( c._buf0, n, 1 ))
+			return lz4f_fail_write;
+		return lz4f_ok;
+	}
+
+	/*
+		decode the frame into pd until there is some output or the
+		input ends, n receives the bytes decoded
+		input is read as LZ4F_decompress asks for it so a pipe is
+		never waited on for more than the next block, and frames
+		that follow each other are read back to back as lz4 does
+	*/
+	lz4f_error_t pull_frame( lz4f_io_s* fp, unsigned char* pd, const size_t nmax, size_t& n )
+	{
+		n = 0;
+		while(0==n)
+		{
+			if(c._bufi==c._bufz)
+			{
+				size_t want = (0<frame->hint) ? std::min( frame->hint, c._size ) : 4;
+				size_t nr = fp->read( c._buf0, 1, want );
+				c._bufi = c._buf0;
+				c._bufz = c._buf0 + nr;
+				if(0==nr)
+				{
+					eof = true;
+					// input that stops inside a frame is damaged
+					return (0==frame->hint) ? lz4f_ok : lz4f_bad_frame;
+				}
+			}
+			size_t dn = nmax;
+			size_t cn = c._bufz - c._bufi;
+			size_t hint = LZ4F_decompress( frame->dctx, pd, &dn, c._bufi, &cn, NULL );
+			if(LZ4F_isError(hint))
+			{
+				eof = true;
+				return lz4f_fail_decompress;
+			}
+			frame->hint = hint;
+			c._bufi += cn;
+			n = dn;
+		}
+		pos += n;
+		return lz4f_ok;
+	}
+
+	lz4f_error_t flush( lz4f_io_s* fp )
+	{
+		if('w'!=fmode)
+			return lz4f_ok;
+		lz4f_error_t e = push_w(fp);
+		if(lz4f_ok != e || NULL==pool)
+			return e;
+		return pool->drain(fp,ix);
+	}
+
+	lz4f_error_t push_w( lz4f_io_s* fp )
+	{
+		if(0>=(d._bufi - d._buf0))
+			return lz4f_ok;
+		if(NULL!=pool)
+			return pool->push_w(fp,d,ix);
+		lz4f_error_t e = push_span( fp, d._buf0, d._bufi - d._buf0 );
+		if(lz4f_ok != e)
+			return e;
+		d._bufi=d._buf0;
+		return lz4f_ok;
+	}
+
+	/*
+		compress and write ibytes at src as one block on the calling
+		thread, src may be the caller's memory as it is not kept
+	*/
+	lz4f_error_t push_span( lz4f_io_s* fp, unsigned char* src, const size_t ibytes )
+	{
+		if(NULL!=frame)
+			return push_frame( fp, src, ibytes );
+		lz4f_sizes_s zz;
+		unsigned char* pwbuf;
+		lz4f_error_t e = lz4f_compress_span( src, ibytes, c, cs, zz, pwbuf );
+		if(lz4f_ok != e)
+			return e;
+		return lz4f_write_block( fp, zz, pwbuf, ix );
+	}
+
+	/*
+		decode the next block into d, at the end mark of a frame go
+		on with the frame after it if there is one
+	*/
+	lz4f_error_t pull_r( lz4f_io_s* fp )
+	{
+		lz4f_error_t e = pull_block(fp);
+		bool more = true;
+		while(lz4f_ok == e && eof && more && NULL==frame && !plain)
+		{
+			e = next_frame(fp,more);
+			if(lz4f_ok == e && more)
+			{
+				eof = false;
+				e = pull_block(fp);
+			}
+		}
+		return e;
+	}
+
+	lz4f_error_t pull_block( lz4f_io_s* fp )
+	{
+		if(plain && NULL!=map)
+		{
+			// the rest of the mapping is handed out in place
+			d._bufi = (unsigned char*)map + mpos;
+			d._bufz = (unsigned char*)map + mapsize;
+			mpos = mapsize;
+			eof = (0==d.remaining());
+			pos += d.remaining();
+			return lz4f_ok;
+		}
+		if(plain)
+		{
+			size_t n = fp->read( d._buf0, 1, d._size );
+			d._bufi = d._buf0;
+			d._bufz = d._buf0 + n;
+			eof = (0==n);
+			pos += n;
+			return lz4f_ok;
+		}
+		if(NULL!=frame)
+		{
+			size_t n;
+			lz4f_error_t e = pull_frame( fp, d._buf0, d._size, n );
+			d._bufi = d._buf0;
+			d._bufz = d._buf0 + n;
+			return e;
+		}
+		if(0!=dictid && NULL==primer(dictid))
+		{
+			// opened without the dictionary the frame needs
+			eof = true;
+			return lz4f_bad_dict;
+		}
+		if(NULL!=pool)
+		{
+			lz4f_error_t e = pool->pull_r(d,eof);
+			nblocks += eof ? 0 : 1;
+			pos += d.remaining();
+			return e;
+		}
+		unsigned char* pd = d._buf0;
+		if(NULL!=sd)
+		{
+			if(ringo + bsize > d._size)
+				ringo = 0;
+			pd += ringo;
+		}
+		lz4f_sizes_s zz;
+		const unsigned char* pc = c._buf0;
+		lz4f_error_t e = (NULL!=map)
+			? lz4f_map_block( map, mapsize, mpos, zz, pc, bsize )
+			: lz4f_fetch_block( fp, zz, c, pd, bsize );
+		if(lz4f_ok == e && NULL!=map && 0 != (zz.c_size & NCBIT) && NULL==sd)
+		{
+			// stored blocks are read straight from the mapping
+			d._bufi = (unsigned char*)pc;
+			d._bufz = d._bufi + zz.d_size;
+		}
+		else
+		if(lz4f_ok == e)
+		{
+			e = lz4f_decode_span( zz, pc, pd, sd, primer(dictid) );
+			if(lz4f_ok == e)
+			{
+				d._bufi = pd;
+				d._bufz = pd + zz.d_size;
+			}
+		}
+		if(lz4f_ok != e || 0 == zz.d_size)
+			eof = true;
+		else
+		{
+			ringo += zz.d_size;
+			pos += zz.d_size;
+			++nblocks;
+		}
+		return e;
+	}
+
+	/*
+		read and decompress the next independent block straight to
+		pd on the calling thread, pd has room for bsize bytes and
+		n receives the decompressed size
+	*/
+	lz4f_error_t pull_span( lz4f_io_s* fp, unsigned char* pd, size_t& n )
+	{
+		lz4f_error_t e = pull_block_span(fp,pd,n);
+		bool more = false;
+		if(lz4f_ok == e && eof && NULL==frame && !plain)
+			e = next_frame(fp,more);
+		/*
+			the next frame may have other blocks so n is left 0 and
+			the caller looks again at how to read it
+		*/
+		if(lz4f_ok == e && more)
+			eof = false;
+		return e;
+	}
+
+	lz4f_error_t pull_block_span( lz4f_io_s* fp, unsigned char* pd, size_t& n )
+	{
+		if(plain && NULL!=map)
+		{
+			n = std::min( bsize, mapsize - mpos );
+			memcpy( pd, map + mpos, n );
+			mpos += n;
+			eof = (0==n);
+			pos += n;
+			return lz4f_ok;
+		}
+		if(plain)
+		{
+			n = fp->read( pd, 1, bsize );
+			eof = (0==n);
+			pos += n;
+			return lz4f_ok;
+		}
+		if(NULL!=frame)
+			return pull_frame( fp, pd, bsize, n );
+		n = 0;
+		if(0!=dictid && NULL==primer(dictid))
+		{
+			eof = true;
+			return lz4f_bad_dict;
+		}
+		lz4f_sizes_s zz;
+		const unsigned char* pc = c._buf0;
+		lz4f_error_t e = (NULL!=map)
+			? lz4f_map_block( map, mapsize, mpos, zz, pc, bsize )
+			: lz4f_fetch_block( fp, zz, c, pd, bsize );
+		if(lz4f_ok == e && NULL!=map && 0 != (zz.c_size & NCBIT))
+			memcpy( pd, pc, zz.d_size );
+		else
+		if(lz4f_ok == e)
+			e = lz4f_decode_span( zz, pc, pd, NULL, primer(dictid) );
+		if(lz4f_ok != e || 0 == zz.d_size)
+			eof = true;
+		else
+		{
+			n = zz.d_size;
+			++nblocks;
+		}
+		pos += n;
+		return e;
+	}
+
+	/*
+		read nbytes at uncompressed offset off without touching the
+		read position, d or c, so any number of threads may call it
+		at once next to each other and next to sequential reads
+
+		each call decodes through its own buffers, whole blocks go
+		straight to the caller
+	*/
+	size_t pread( lz4f_io_s* fp, unsigned char* pbytes, const size_t nbytes, const unsigned long long off )
+	{
+		if(plain)
+		{
+			// plain input is read where it lies
+			long long z = fp->size();
+			lz4ferr = (0 > z) ? lz4f_bad_arg : lz4f_ok;
+			if(0 > z || (unsigned long long)z < cfirst || (unsigned long long)z - cfirst <= off)
+				return 0;
+			size_t n = (size_t)std::min( (unsigned long long)nbytes, (unsigned long long)z - cfirst - off );
+			if(!fp->read_at( pbytes, n, cfirst + off ))
+			{
+				lz4ferr = lz4f_fail_read;
+				return 0;
+			}
+			return n;
+		}
+		ix.load(fp,cfirst);
+		if(!ix.present || NULL!=sd || NULL!=frame)
+		{
+			lz4ferr = lz4f_bad_arg;
+			return 0;
+		}
+		// an index is of one frame so the first dictionary holds
+		const lz4f_dict_s* prime = primer(dictid0);
+		if(0!=dictid0 && NULL==prime)
+		{
+			lz4ferr = lz4f_bad_dict;
+			return 0;
+		}
+		lz4ferr = lz4f_ok;
+		if(0==ix.count || 0==nbytes)
+			return 0;
+		lz4fbuf_s cb;
+		lz4fbuf_s db;
+		if(!cb.alloc( LZ4_compressBound((int)bsize) ))
+		{
+			lz4ferr = lz4f_fail_heap;
+			return 0;
+		}
+		size_t done = 0;
+		const lz4f_index_entry_s* pz = ix.pe + ix.count;
+		for(const lz4f_index_entry_s* pe = ix.find(off); pe < pz && done < nbytes; ++pe)
+		{
+			unsigned long long skip = off + done - pe->d_offset;
+			unsigned long long dnext = (pe+1 < pz) ? pe[1].d_offset : ix.d_next;
+			if(pe->d_offset + skip >= dnext)
+				continue;
+			size_t take = (size_t)std::min( dnext - pe->d_offset - skip, (unsigned long long)(nbytes - done) );
+			unsigned char* pd = pbytes + done;
+			if(0 < skip || take < dnext - pe->d_offset)
+			{
+				if(NULL==db._buf0 && !db.alloc( bsize ))
+				{
+					lz4ferr = lz4f_fail_heap;
+					break;
+				}
+				pd = db._buf0;
+			}
+			lz4f_sizes_s zz;
+			lz4f_error_t e = lz4f_fetch_block_at( fp, pe->c_offset, zz, cb, pd, (pd==db._buf0) ? bsize : take );
+			if(lz4f_ok == e && (unsigned long long)zz.d_size != dnext - pe->d_offset)
+				e = lz4f_bad_frame;
+			if(lz4f_ok == e)
+				e = lz4f_decode_span( zz, cb._buf0, pd, NULL, prime );
+			if(lz4f_ok != e)
+			{
+				lz4ferr = e;
+				break;
+			}
+			if(pd == db._buf0)
+				memcpy( pbytes + done, pd + skip, take );
+			done += take;
+		}
+		return done;
+	}
+
+	// uncompressed offset of the next byte to read
+	unsigned long long tell() const
+	{
+		return pos - d.remaining();
+	}
+
+	/*
+		move the read position to uncompressed offset off
+
+		with an index only the block holding off is decoded
+		without one, or for linked blocks which need the blocks
+		before them, a backward move restarts at the first block
+		and a forward move decodes its way there
+		an off past the end stops at the end
+	*/
+	lz4f_error_t seek( lz4f_io_s* fp, const unsigned long long off )
+	{
+		unsigned long long at = tell();
+		if(off >= at && off - at <= d.remaining())
+		{
+			d._bufi += off - at;
+			return lz4f_ok;
+		}
+		if(NULL!=pool)
+			pool->pause();
+		bool restart = (off < at);
+		unsigned long long c_offset = cfirst;
+		unsigned long long d_offset = 0;
+		long long z = plain ? fp->size() : -1;
+		if(plain && 0 <= z && (unsigned long long)z >= cfirst)
+		{
+			// plain input maps offsets one to one, up to its end
+			restart = true;
+			d_offset = std::min( off, (unsigned long long)z - cfirst );
+			c_offset = cfirst + d_offset;
+		}
+		if(!plain)
+			ix.load(fp,cfirst);
+		unsigned long long n_blocks = 0;
+		if(NULL==sd && NULL==frame && !plain && ix.present && 0<ix.count)
+		{
+			const lz4f_index_entry_s* pe = ix.find(off);
+			restart = true;
+			c_offset = pe->c_offset;
+			d_offset = pe->d_offset;
+			n_blocks = pe - ix.pe;
+		}
+		// nothing changes when the input cannot go to c_offset, as a pipe
+		if(restart && NULL==map && !fp->seek( (long long)c_offset, SEEK_SET ))
+		{
+			if(NULL!=pool)
+				pool->resume(false);
+			return lz4f_fail_read;
+		}
+		lz4f_error_t e = lz4f_ok;
+		// going back to the first frame needs its blocks and dictionary again
+		if(restart && NULL==frame && !plain)
+		{
+			dictid = dictid0;
+			if(bsize0 != bsize || linked0 != (NULL!=sd))
+				e = reset( bsize0, linked0, fp );
+			else
+			if(NULL!=pool)
+				pool->prime = primer(dictid);
+		}
+		if(restart)
+		{
+			if(NULL!=map)
+				mpos = (size_t)std::min( c_offset, (unsigned long long)mapsize );
+			d._bufi = d._buf0;
+			d._bufz = d._buf0;
+			pos = d_offset;
+			eof = false;
+			ringo = 0;
+			nblocks = n_blocks;
+			if(NULL!=sd)
+				start_sd();
+			if(NULL!=frame)
+			{
+				// decode the frame again from its magic number
+				c._bufi = c._bufz = c._buf0;
+				frame->hint = 0;
+				LZ4F_freeDecompressionContext(frame->dctx);
+				frame->dctx = NULL;
+				if(LZ4F_isError( LZ4F_createDecompressionContext( &frame->dctx, LZ4F_VERSION ) ))
+					e = lz4f_fail_heap;
+			}
+		}
+		if(NULL!=pool)
+			pool->resume(restart);
+		while(lz4f_ok == e && tell() < off)
+		{
+			if(0==d.remaining())
+			{
+				if(eof)
+					break;
+				e = pull_r(fp);
+				continue;
+			}
+			d._bufi += (size_t)std::min( (unsigned long long)d.remaining(), off - tell() );
+		}
+		return e;
+	}
+
+	size_t write( lz4f_io_s* fp, const unsigned char* pbytes, const size_t nbytes )
+	{
+		unsigned char* pfr = (unsigned char*)pbytes;
+		unsigned char* pto = pfr + nbytes;
+		reserved = 0;
+		while(pfr < pto)
+		{
+			if(0==d.remaining())
+			{
+				lz4f_error_t e = push_w(fp);
+				if(lz4f_ok != e)
+				{
+					lz4ferr = e;
+					return 0;
+				}
+			}
+			/*
+				whole blocks are compressed straight from the caller
+				when nothing is staged, only the tail is copied to d
+				the workers need the bytes to outlive this call so the
+				pool still copies every block into its slot
+			*/
+			if(NULL==pool && d._bufi==d._buf0 && (size_t)(pto-pfr) >= bsize)
+			{
+				lz4f_error_t e = push_span( fp, pfr, bsize );
+				if(lz4f_ok != e)
+				{
+					lz4ferr = e;
+					return 0;
+				}
+				pfr += bsize;
+				continue;
+			}
+			pfr += d.write(pfr,pto-pfr);
+		}
+		lz4ferr = lz4f_ok;
+		return pfr-pbytes;
+	}
+
+	/*
+		hand out at least nbytes of the current block for the caller
+		to fill in place, the block is sent early when less is left
+	*/
+	unsigned char* reserve( lz4f_io_s* fp, const size_t nbytes )
+	{
+		if(nbytes > bsize)
+		{
+			lz4ferr = lz4f_bad_arg;
+			return NULL;
+		}
+		reserved = 0;
+		if(0==d.remaining() || nbytes > d.remaining())
+		{
+			lz4f_error_t e = push_w(fp);
+			if(lz4f_ok != e)
+			{
+				lz4ferr = e;
+				return NULL;
+			}
+		}
+		reserved = d.remaining();
+		lz4ferr = lz4f_ok;
+		return d._bufi;
+	}
+
+	size_t commit( const size_t nbytes )
+	{
+		if(nbytes > reserved)
+		{
+			lz4ferr = lz4f_bad_arg;
+			return 0;
+		}
+		d._bufi += nbytes;
+		reserved = 0;
+		lz4ferr = lz4f_ok;
+		return nbytes;
+	}
+
+	size_t read( lz4f_io_s* fp, unsigned char* pbytes, const size_t nbytes )
+	{
+		unsigned char* pfr = (unsigned char*)pbytes;
+		unsigned char* pto = pfr + nbytes;
+		lz4ferr = lz4f_ok;
+		while(pfr < pto)
+		{
+			if(0==d.remaining())
+			{
+				if(eof)
+					break;
+				/*
+					when a whole block fits it is decoded straight to
+					the caller, workers decode ahead into their slots
+					and linked blocks need their history kept in d
+				*/
+				if(NULL==pool && NULL==sd && (size_t)(pto-pfr) >= bsize)
+				{
+					size_t n;
+					lz4f_error_t e = pull_span(fp,pfr,n);
+					if(lz4f_ok != e)
+					{
+						lz4ferr = e;
+						break;
+					}
+					pfr += n;
+					continue;
+				}
+				lz4f_error_t e = pull_r(fp);
+				if(lz4f_ok != e)
+				{
+					lz4ferr = e;
+					break;
+				}
+			}
+			pfr += d.read(pfr,pto-pfr);
+		}
+		return pfr-pbytes;
+	}
+
+	/*
+		hand out the rest of the current block without copying
+		the bytes stay in d until the next call on this handle
+	*/
+	size_t view( lz4f_io_s* fp, const unsigned char** ppbytes )
+	{
+		lz4ferr = lz4f_ok;
+		if(0==d.remaining() && !eof)
+		{
+			lz4f_error_t e = pull_r(fp);
+			if(lz4f_ok != e)
+			{
+				lz4ferr = e;
+				return 0;
+			}
+		}
+		size_t rem = d.remaining();
+		*ppbytes = d._bufi;
+		d._bufi = d._bufz;
+		return rem;
+	}
+
+	/*
+		copy up to and including delim, at most nbytes-1 bytes,
+		and terminate with a 0 byte, nbytes must be at least 1
+	*/
+	size_t getdelim( lz4f_io_s* fp, char* pbytes, const size_t nbytes, const int delim )
+	{
+		char* pfr = pbytes;
+		char* pto = pbytes + nbytes - 1;
+		bool found = false;
+		while(pfr < pto && !found)
+		{
+			if(0==d.remaining())
+			{
+				if(eof)
+					break;
+				lz4f_error_t e = pull_r(fp);
+				if(lz4f_ok != e)
+				{
+					lz4ferr = e;
+					return 0;
+				}
+				continue;
+			}
+			pfr += d.getdelim(pfr,pto-pfr,delim,found);
+		}
+		*pfr=0;
+		lz4ferr = lz4f_ok;
+		return pfr-pbytes;
+	}
+
+	/*
+		hand out the next record up to and including delim in place
+		a record split across blocks is gathered into line instead
+		the bytes stay valid until the next call on this handle
+	*/
+	size_t getdelim_view( lz4f_io_s* fp, const char** ppbytes, const int delim )
+	{
+		size_t n = 0;
+		lz4ferr = lz4f_ok;
+		for(;;)
+		{
+			if(0==d.remaining())
+			{
+				if(eof)
+					break;
+				lz4f_error_t e = pull_r(fp);
+				if(lz4f_ok != e)
+				{
+					lz4ferr = e;
+					return 0;
+				}
+				continue;
+			}
+			bool found;
+			const char* p = (const char*)d._bufi;
+			size_t rem = d.find(d.remaining(),delim,found);
+			d._bufi += rem;
+			if(found && 0==n)
+			{
+				*ppbytes = p;
+				return rem;
+			}
+			if(n + rem > linesize)
+			{
+				size_t z = std::max( 2*linesize, std::max( n + rem, (size_t)256 ) );
+				char* pl = new (std::nothrow) char[z];
+				if(NULL==pl)
+				{
+					lz4ferr = lz4f_fail_heap;
+					return 0;
+				}
+				if(0<n)
+					memcpy(pl,line,n);
+				delete [] line;
+				line = pl;
+				linesize = z;
+			}
+			memcpy(line+n,p,rem);
+			n += rem;
+			if(found)
+				break;
+		}
+		*ppbytes = line;
+		return n;
+	}
+};
+
+int lz4eof		( lz4File f )
+{
+	if(NULL==f)
+	{
+		return lz4ferr = lz4f_bad_arg;
+	}
+	if('r'==f->pb->fmode)
+		return (f->pb->eof && 0==f->pb->d.remaining()) ? 1 : 0;
+	return f->io->eof();
+}
+
+int lz4close	( lz4File f )
+{
+	if(NULL==f)
+	{
+		return lz4ferr = lz4f_bad_arg;
+	}
+	if(NULL==f->io)
+	{
+		return lz4ferr = lz4f_bad_arg;
+	}
+
+	if('w'==f->pb->fmode)
+	{
+
+		lz4ferr = f->pb->flush(f->io);
+
+		bool framed = NULL!=f->pb->frame;
+		if(lz4ferr == lz4f_ok && framed)
+		{
+			lz4ferr = f->pb->end_frame(f->io);
+		}
+
+		if(lz4ferr == lz4f_ok && !framed)
+		{
+			unsigned int zero[2]={0,0};
+			size_t result = f->io->write( zero,4,2 );
+			if(2!=result)
+			{
+				lz4ferr = lz4f_fail_write;
+			}
+		}
+
+		bool streaming = 0 != (f->h.lz4c.rffu & LZ4F_RFFU_STREAM);
+		lz4f_header_s h = f->h;
+		h.lz4c.c_size = (0<h.lz4c.content_size) ? 1 : 0;
+		h.lz4c.hc = lz4f_header_checksum(h);
+
+		if(lz4ferr == lz4f_ok && !framed)
+		{
+			lz4ferr = f->pb->ix.write(f->io,h.lz4c.hc);
+		}
+
+		if(lz4ferr == lz4f_ok && !framed && !streaming)
+		{
+			//write the final header where the stream started
+			size_t zh = sizeof(h) + ((0 != (h.lz4c.rffu & LZ4F_RFFU_DICT)) ? sizeof(f->pb->dictid) : 0);
+			if(false
+				|| false == f->io->seek(f->pb->cfirst-zh,SEEK_SET)
+				|| 1!=f->io->write( &h,sizeof(h),1 )
+			)
+				lz4ferr = lz4f_fail_write;
+		}
+
+	}
+
+	delete f->pb;
+	f->io->close();
+	delete f->io;
+	delete f;
+	return lz4ferr;
+}
+
+#define LZ4F_THREADS_PER_CPU	4	// cap on "tN" per cpu available
+
+struct lz4f_mode_s
+{
+	char m;
+	int compression_level;
+	int thread_count;
+	int block_maxsize;
+	bool block_linked;
+	bool mapped;
+	bool streaming;
+	bool raw;
+	bool framed;
+	bool append;
+	const void* dict;	// dictionary for lz4open_dict or NULL
+	size_t dictsize;
+};
+
+/*
+	parses an lz4open mode string, false when it is not supported
+*/
+bool lz4f_parse_mode( const char * fmode, lz4f_mode_s& o )
+{
+	if(NULL==fmode)
+		return false;
+
+	if(true
+		&& 'w' != fmode[0] 
+		&& 'r' != fmode[0]
+		&& 'a' != fmode[0]
+	)
+		return false;
+
+	// "a" writes a new frame after the end of the file
+	const bool w = ('r' != fmode[0]);
+	o.m = w ? 'w' : 'r';
+	o.compression_level=9;
+	o.thread_count=w ? 1 : 0;
+	o.block_maxsize=LZ4F_BMAX_DEF;
+	o.block_linked=false;
+	o.mapped=false;
+	o.streaming=false;
+	o.raw=false;
+	o.framed=false;
+	o.append=('a'==fmode[0]);
+	o.dict=NULL;
+	o.dictsize=0;
+	for(const char* pm=fmode+1; 0!=*pm; ++pm)
+	{
+		if('b'==*pm)
+		{
+			continue;
+		}
+		if(w && isdigit(*pm))
+		{
+			// "wN" with N up to LZ4F_LEVEL_MAX_HC
+			o.compression_level = *pm - '0';
+			while(isdigit(pm[1]) && LZ4F_LEVEL_MAX_HC >= o.compression_level)
+				o.compression_level = o.compression_level*10 + (*++pm - '0');
+			if(LZ4F_LEVEL_MAX_HC < o.compression_level)
+				return false;
+			if(LZ4F_LEVEL_MIN_HC > o.compression_level)
+				o.compression_level = -1;
+			continue;
+		}
+		if(w && 'f'==*pm)
+		{
+			// "wfA" is the fast compressor with acceleration A
+			o.compression_level = -1;
+			if(isdigit(pm[1]))
+			{
+				int acceleration = 0;
+				while(isdigit(pm[1]) && 0x10000 >= acceleration)
+					acceleration = acceleration*10 + (*++pm - '0');
+				if(0x10000 < acceleration)
+					return false;
+				if(0 < acceleration)
+					o.compression_level = -acceleration;
+			}
+			continue;
+		}
+		if(w && 'B'==*pm && 'D'==pm[1])
+		{
+			// "BD" links each block to the previous 64KB of input
+			o.block_linked = true;
+			++pm;
+			continue;
+		}
+		if(w && 'B'==*pm)
+		{
+			// "BN" selects the block size as in the b_maxsize table
+			if(0==lz4f_block_size(pm[1]-'0'))
+				return false;
+			o.block_maxsize = *++pm - '0';
+			continue;
+		}
+		if(w && 'F'==*pm)
+		{
+			// "F" writes a standard lz4 frame
+			o.framed = true;
+			continue;
+		}
+		if(w && 's'==*pm)
+		{
+			// "s" writes the header once, as for a pipe
+			o.streaming = true;
+			continue;
+		}
+		if('r'==fmode[0] && 'm'==*pm)
+		{
+			// "m" decodes the blocks in place from a file mapping
+			o.mapped = true;
+			continue;
+		}
+		if('u'==*pm)
+		{
+			// "u" does the file i/o on the descriptor without stdio
+			o.raw = true;
+			continue;
+		}
+		if('t'==*pm)
+		{
+			// "tN" asks for N worker threads
+			// a bare "t" uses every cpu available to the process
+			if(!isdigit(pm[1]))
+			{
+				o.thread_count = (int)get_cpu_count();
+				continue;
+			}
+			o.thread_count = 0;
+			while(isdigit(pm[1]))
+				o.thread_count = std::min( o.thread_count*10 + (*++pm - '0'), 0x10000 );
+			// more threads than cpus only adds switching and buffers
+			o.thread_count = std::min( o.thread_count, LZ4F_THREADS_PER_CPU*(int)get_cpu_count() );
+			continue;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+/*
+	reads or writes the header on fp and sets up the buffers,
+	fp is left to the caller when this fails
+*/
+lz4File lz4f_open( lz4f_io_s* fp, const lz4f_mode_s& o )
+{
+	lz4f_header_s h = lz4f_init_header();
+	assert( true == h.is_valid_header_signature() );
+
+	bool framed = o.framed;
+	bool plain = false;
+	unsigned int dictid = 0;
+	unsigned char pfx[sizeof(h)];
+	size_t npfx = 0;
+	if('r'==o.m)
+	{
+		// a standard lz4 frame starts with its magic number instead
+		static const unsigned char magic[4] = { 0x04, 0x22, 0x4D, 0x18 };
+		npfx = fp->read( pfx, 1, sizeof(magic) );
+		framed = sizeof(magic)==npfx && 0==memcmp( pfx, magic, sizeof(magic) );
+		if(sizeof(magic)==npfx && !framed)
+			npfx += fp->read_ahead( pfx + sizeof(magic), sizeof(h) - sizeof(magic), sizeof(lz4f_sizes_s) );
+		memcpy( &h, pfx, npfx );
+		// anything else is not compressed and read as it is, as gzread does
+		plain = !framed && (sizeof(h)!=npfx || false == h.is_valid_header_signature());
+		if(plain && fp->seek( -(long long)npfx, SEEK_CUR ))
+			npfx = 0;
+		if(framed || plain)
+			h = lz4f_init_header();
+		else
+		if(0 == lz4f_block_size(h.lz4c.b_maxsize))
+		{
+			lz4ferr = lz4f_bad_header;
+			return NULL;
+		}
+		else
+		if(0 != (h.lz4c.rffu & LZ4F_RFFU_DICT) && 1!=fp->read( &dictid, sizeof(dictid), 1 ))
+		{
+			lz4ferr = lz4f_bad_header;
+			return NULL;
+		}
+		// a dictionary given must be the one recorded
+		if(0!=dictid && NULL!=o.dict && dictid != lz4f_dict_id( o.dict, o.dictsize ))
+		{
+			lz4ferr = lz4f_bad_dict;
+			return NULL;
+		}
+	}
+	else
+	if('w'==o.m)
+	{
+		h.lz4c.b_maxsize = o.block_maxsize;
+		h.lz4c.b_independent = o.block_linked ? 0 : 1;
+		if(NULL!=o.dict)
+		{
+			// the lz4frame here has no dictionary support
+			if(framed)
+			{
+				lz4ferr = lz4f_bad_arg;
+				return NULL;
+			}
+			dictid = lz4f_dict_id( o.dict, o.dictsize );
+			h.lz4c.rffu |= LZ4F_RFFU_DICT;
+		}
+		/*
+			an appended frame starts at the end of the file, output
+			that cannot seek is taken to be there already, and the
+			header before it is never rewritten
+		*/
+		if(o.append)
+			fp->seek(0,SEEK_END);
+		if(o.streaming || o.append || 0 > fp->tell())
+		{
+			// the header cannot be rewritten on close
+			h.lz4c.rffu |= LZ4F_RFFU_STREAM;
+			h.lz4c.hc = lz4f_header_checksum(h);
+		}
+		// init writes the header of a standard frame
+		size_t result = framed ? 1 : fp->write( &h, sizeof(h), 1 );
+		if(1==result && 0!=dictid)
+			result = fp->write( &dictid, sizeof(dictid), 1 );
+		if(1!=result)
+		{
+			lz4ferr = lz4f_fail_write;
+			return NULL;
+		}
+	}
+	else
+	{
+		assert(false);
+	}
+
+	lz4File f = new lz4File_s;
+	if(NULL==f)
+	{
+		lz4ferr = lz4f_fail_heap;
+		return NULL;
+	}
+	lz4f_buffers_s* pb = new lz4f_buffers_s;
+	if(NULL==pb)
+	{
+		lz4ferr = lz4f_fail_heap;
+		delete f;
+		return NULL;
+	}
+
+	if(!pb->dict.set( o.dict, o.dictsize ))
+	{
+		lz4ferr = lz4f_fail_heap;
+		delete pb;
+		delete f;
+		return NULL;
+	}
+
+	lz4f_error_t e = pb->init
+	(
+		 o.m
+		,o.compression_level
+		,o.thread_count
+		,lz4f_block_size(h.lz4c.b_maxsize)
+		,0 == h.lz4c.b_independent
+		,o.mapped
+		,framed
+		,plain
+		,dictid
+		,fp
+	);
+	if(lz4f_ok != e)
+	{
+		lz4ferr = e;
+		delete pb;
+		delete f;
+		return NULL;
+	}
+
+	if(plain && 0<npfx)
+	{
+		// the input cannot seek back so the bytes read come first
+		memcpy( pb->d._buf0, pfx, npfx );
+		pb->d._bufz = pb->d._buf0 + npfx;
+		pb->pos = npfx;
+	}
+
+	if('r'==o.m && !framed && !plain)
+		pb->ix.load(fp,pb->cfirst);
+
+	if(pb->ix.several)
+	{
+		// the header only counts the first of several frames
+		h.lz4c.content_size = 0;
+		h.lz4c.c_size = 0;
+	}
+	else
+	if('r'==o.m && 0 != (h.lz4c.rffu & LZ4F_RFFU_STREAM))
+	{
+		/*
+			a streamed file keeps its content size in the index tail
+			which is only reachable when the input is a real file
+		*/
+		lz4f_header_s hf = h;
+		hf.lz4c.content_size = pb->ix.d_next;
+		hf.lz4c.c_size = (0<hf.lz4c.content_size) ? 1 : 0;
+		if(pb->ix.present && pb->ix.hc == lz4f_header_checksum(hf))
+			h = hf;
+	}
+
+	f->io = fp;
+	f->pb = pb;
+	f->h = h;
+
+	lz4ferr = lz4f_ok;
+
+	return f;
+}
+
+/*
+	lz4f_open on a stdio file, pf is left to the caller on failure
+*/
+lz4File lz4f_open_file( FILE* pf, const lz4f_mode_s& o )
+{
+	lz4f_io_s* fp = new lz4f_io_s;
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_heap;
+		return NULL;
+	}
+	fp->file = pf;
+	lz4File f = lz4f_open(fp,o);
+	if(NULL==f)
+		delete fp;
+	return f;
+}
+
+/*
+	lz4f_open on a descriptor used without stdio, fd is left to
+	the caller on failure
+*/
+lz4File lz4f_open_fd( const int fd, const lz4f_mode_s& o )
+{
+	lz4f_io_s* fp = new lz4f_io_s;
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_heap;
+		return NULL;
+	}
+	fp->fd = fd;
+	lz4File f = lz4f_open(fp,o);
+	if(NULL==f)
+		delete fp;
+	return f;
+}
+
+/*
+	opens fname as the mode in o asks
+*/
+lz4File lz4f_open_name( const char* fname, const lz4f_mode_s& o )
+{
+	if(o.raw)
+	{
+		int fd = open_file_fd(fname,o.append ? 'a' : o.m);
+		if(0>fd)
+		{
+			lz4ferr = lz4f_fail_open;
+			return NULL;
+		}
+		lz4File f = lz4f_open_fd(fd,o);
+		if(NULL==f)
+			close_file_fd(fd);
+		return f;
+	}
+
+	FILE* fp = fopen(fname,o.append ? "ab" : ('w'==o.m) ? "wb" : "rb");
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_open;
+		return NULL;
+	}
+
+	lz4File f = lz4f_open_file(fp,o);
+	if(NULL==f)
+		fclose(fp);
+	return f;
+}
+
+lz4File lz4open (const char * fname, const char * fmode)
+{
+	lz4f_mode_s o;
+	if(NULL==fname || false==lz4f_parse_mode(fmode,o))
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+	return lz4f_open_name(fname,o);
+}
+
+lz4File lz4open_dict (const char * fname, const char * fmode, const void * pdict, const size_t ndict)
+{
+	lz4f_mode_s o;
+	if(NULL==fname || NULL==pdict || false==lz4f_parse_mode(fmode,o))
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+	o.dict = pdict;
+	o.dictsize = ndict;
+	return lz4f_open_name(fname,o);
+}
+
+unsigned int lz4dictid (lz4File f)
+{
+	if(NULL==f)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	lz4ferr = lz4f_ok;
+	return f->pb->dictid0;
+}
+
+unsigned int lz4dictid_of (const void * pdict, const size_t ndict)
+{
+	if(NULL==pdict)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	lz4ferr = lz4f_ok;
+	return lz4f_dict_id(pdict,ndict);
+}
+
+lz4File lz4dopen (const int fd, const char * fmode)
+{
+	lz4f_mode_s o;
+	if(0>fd || false==lz4f_parse_mode(fmode,o))
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+
+	// fd itself is used, as gzdopen does, and is left open on failure
+	if(o.raw)
+		return lz4f_open_fd(fd,o);
+
+	FILE* fp = open_file_fdopen(fd,o.append ? "ab" : ('w'==o.m) ? "wb" : "rb");
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_open;
+		return NULL;
+	}
+
+	lz4File f = lz4f_open_file(fp,o);
+	if(NULL==f)
+		close_file_keep_fd(fp,fd);
+	return f;
+}
+
+lz4File lz4fopen (FILE* fp, const char * fmode)
+{
+	lz4f_mode_s o;
+	if(NULL==fp || false==lz4f_parse_mode(fmode,o))
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+	return lz4f_open_file(fp,o);
+}
+
+lz4File lz4open_io (const lz4f_io_vtable_s * vt, void * user, const char * fmode)
+{
+	lz4f_mode_s o;
+	if(NULL==vt || false==lz4f_parse_mode(fmode,o))
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+	if(('w'==o.m) ? NULL==vt->write : NULL==vt->read)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+
+	lz4f_io_s* fp = new lz4f_io_s;
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_heap;
+		return NULL;
+	}
+	fp->vt = vt;
+	fp->user = user;
+	lz4File f = lz4f_open(fp,o);
+	if(NULL==f)
+		delete fp;
+	return f;
+}
+
+lz4File lz4memopen (const void * pbytes, const size_t nbytes, const char * fmode)
+{
+	lz4f_mode_s o;
+	if(NULL==pbytes || false==lz4f_parse_mode(fmode,o) || 'r'!=o.m)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+
+	lz4f_io_s* fp = new lz4f_io_s;
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_heap;
+		return NULL;
+	}
+	fp->mem = (unsigned char*)pbytes;
+	fp->memsize = nbytes;
+
+	// the blocks are decoded in place as from a mapped file
+	o.mapped = true;
+	lz4File f = lz4f_open(fp,o);
+	if(NULL==f)
+		delete fp;
+	return f;
+}
+
+lz4File lz4memopen_grow (void ** ppbytes, size_t * pnbytes, const char * fmode)
+{
+	lz4f_mode_s o;
+	if(NULL==ppbytes || NULL==pnbytes || false==lz4f_parse_mode(fmode,o) || 'w'!=o.m)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+
+	lz4f_io_s* fp = new lz4f_io_s;
+	if(NULL==fp)
+	{
+		lz4ferr = lz4f_fail_heap;
+		return NULL;
+	}
+	fp->mem = (unsigned char*)*ppbytes;
+	fp->memcap = (NULL!=*ppbytes) ? *pnbytes : 0;
+	// "a" keeps the bytes already in the buffer and writes after them
+	fp->memsize = o.append ? fp->memcap : 0;
+	fp->pmem = ppbytes;
+	fp->pmemsize = pnbytes;
+
+	lz4File f = lz4f_open(fp,o);
+	if(NULL==f)
+	{
+		// the header may have moved the buffer already
+		fp->close();
+		delete fp;
+	}
+	return f;
+}
+
+size_t lz4write	( lz4File f, const void* pbytes, const size_t nbytes )
+{
+	if(NULL==f || NULL==pbytes || 'w'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	if(0==nbytes)
+		return 0;
+
+	size_t nw = f->pb->write( f->io, (const unsigned char*)pbytes, nbytes );
+	f->h.lz4c.content_size += nw;
+	return nw;
+}
+
+void* lz4write_reserve ( lz4File f, const size_t nbytes )
+{
+	if(NULL==f || 'w'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return NULL;
+	}
+	return f->pb->reserve( f->io, nbytes );
+}
+
+size_t lz4write_commit ( lz4File f, const size_t nbytes )
+{
+	if(NULL==f || 'w'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	size_t nw = f->pb->commit( nbytes );
+	f->h.lz4c.content_size += nw;
+	return nw;
+}
+
+size_t lz4read	( lz4File f, void* pbytes, const size_t nbytes )
+{
+	if(NULL==f || NULL==pbytes || 'r'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	if(0==nbytes)
+		return 0;
+
+	size_t nr = f->pb->read( f->io, (unsigned char*)pbytes, nbytes );
+	return nr;
+}
+
+char* lz4gets	( lz4File f, char *pbytes, const size_t nbytes )
+{
+	if(NULL==f || NULL==pbytes || 'r'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	if(0==nbytes)
+		return 0;
+
+	if(0==f->pb->getdelim( f->io, pbytes, nbytes, '\n' ))
+		return NULL;
+	return pbytes;
+}
+
+size_t lz4getdelim	( lz4File f, char *pbytes, const size_t nbytes, const int delim )
+{
+	if(NULL==f || NULL==pbytes || 0==nbytes || 'r'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	return f->pb->getdelim( f->io, pbytes, nbytes, delim );
+}
+
+int lz4read_view ( lz4File f, const void** ppbytes, size_t* pnbytes )
+{
+	if(NULL==f || NULL==ppbytes || NULL==pnbytes || 'r'!=f->pb->fmode)
+	{
+		return lz4ferr = lz4f_bad_arg;
+	}
+	const unsigned char* p = NULL;
+	*pnbytes = f->pb->view( f->io, &p );
+	*ppbytes = p;
+	return lz4ferr;
+}
+
+long long lz4seek ( lz4File f, const long long off, const int whence )
+{
+	if(NULL==f || 'r'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return -1;
+	}
+	long long base = 0;
+	if(SEEK_CUR==whence)
+		base = (long long)f->pb->tell();
+	else
+	if(SEEK_END==whence)
+	{
+		base = (long long)f->h.lz4c.content_size;
+		if(0==base)
+		{
+			// without a recorded size, such as in a frame, decode to the end
+			lz4ferr = f->pb->seek( f->io, ~0ULL );
+			if(lz4f_ok != lz4ferr)
+				return -1;
+			base = (long long)f->pb->tell();
+		}
+	}
+	else
+	if(SEEK_SET!=whence)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return -1;
+	}
+	if(0 > base + off)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return -1;
+	}
+	lz4ferr = f->pb->seek( f->io, (unsigned long long)(base + off) );
+	if(lz4f_ok != lz4ferr)
+		return -1;
+	return (long long)f->pb->tell();
+}
+
+size_t lz4pread ( lz4File f, void* pbytes, const size_t nbytes, const long long off )
+{
+	if(NULL==f || NULL==pbytes || 0>off || 'r'!=f->pb->fmode)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return 0;
+	}
+	return f->pb->pread( f->io, (unsigned char*)pbytes, nbytes, (unsigned long long)off );
+}
+
+long long lz4tell ( lz4File f )
+{
+	if(NULL==f)
+	{
+		lz4ferr = lz4f_bad_arg;
+		return -1;
+	}
+	lz4ferr = lz4f_ok;
+	if('w'==f->pb->fmode)
+		return (long long)f->h.lz4c.content_size;
+	return (long long)f->pb->tell();
+}
+
+int lz4getdelim_view ( lz4File f, const char** ppbytes, size_t* pnbytes, const int delim )
+{
+	if(NULL==f || NULL==ppbytes || NULL==pnbytes || 'r'!=f->pb->fmode)
+	{
+		return lz4ferr = lz4f_bad_arg;
+	}
+	const char* p = NULL;
+	*pnbytes = f->pb->getdelim_view( f->io, &p, delim );
+	*ppbytes = p;
+	return lz4ferr;
+}
+
+/*
+	dictionary training
+
+	The samples are cut into d-grams of 8 bytes and the number of
+	samples each d-gram occurs in is counted in a hashed table.  The
+	training bytes are then split into one epoch per segment that
+	fits the dictionary, and every epoch offers its best segments
+	of LZ4F_TRAIN_K bytes, scored by the counts of their d-grams.
+	Last the offers are taken greedily by score, where the d-grams
+	of the segments already taken no longer count.  The first taken
+	goes at the end of the dictionary, the part lz4 keeps in reach
+	longest.
+
+	Workers take samples or epochs from a shared counter, so the
+	result does not depend on how many threads actually started.
+*/
+#define LZ4F_TRAIN_D		8	// bytes per d-gram
+#define LZ4F_TRAIN_K		1024	// bytes per segment
+#define LZ4F_TRAIN_LOG		20	// log2 of the d-gram count table size
+#define LZ4F_TRAIN_OFFERS	3	// segments offered per epoch
+
+struct lz4f_offer_s
+{
+	unsigned long long	score;
+	size_t				pos;	// offset in the training bytes
+
+	bool operator<( const lz4f_offer_s& o ) const
+	{
+		return (score != o.score) ? (score < o.score) : (pos > o.pos);
+	}
+};
+
+struct lz4f_train_s
+{
+	const unsigned char*	ps;		// samples back to back
+	size_t*					offs;	// offset of each sample, offs[n] is the total
+	size_t					n;		// number of samples
+	unsigned int*			cnt;	// samples each hashed d-gram occurs in
+	size_t					ne;		// number of epochs
+	lz4f_offer_s*			po;		// LZ4F_TRAIN_OFFERS per epoch
+	size_t					next;	// next sample or epoch to take
+	bool					failed;	// a worker ran out of memory
+	std::mutex				m;
+
+	lz4f_train_s():ps(NULL),offs(NULL),n(0),cnt(NULL),ne(0),po(NULL),next(0),failed(false)
+	{
+	}
+
+	~lz4f_train_s()
+	{
+		delete [] offs;
+		delete [] cnt;
+		delete [] po;
+	}
+
+	static unsigned int hash( const unsigned char* p )
+	{
+		unsigned long long v;
+		memcpy( &v, p, LZ4F_TRAIN_D );
+		return (unsigned int)((v * 0x9E3779B97F4A7C15ULL) >> (64 - LZ4F_TRAIN_LOG));
+	}
+
+	size_t take()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return next++;
+	}
+
+	// run fn on up to threads threads, the calling one included
+	void run( const int threads, void (lz4f_train_s::*fn)() )
+	{
+		next = 0;
+		std::thread* pt = (1 < threads) ? new std::thread[threads-1] : NULL;
+		int nt = 0;
+		for(; NULL!=pt && nt<threads-1; ++nt)
+		{
+			try
+			{
+				pt[nt] = std::thread( fn, this );
+			}
+			catch(...)
+			{
+				break;
+			}
+		}
+		(this->*fn)();
+		for(int i=0; i<nt; ++i)
+			pt[i].join();
+		delete [] pt;
+	}
+
+	// count of the d-gram at q, 0 when it runs past end, the end of its sample
+	unsigned int at( const size_t q, const size_t end ) const
 	{
-		lz4ferr = lz4f_bad_arg;
-		return NULL;
+		return (q + LZ4F_TRAIN_D <= end) ? cnt[hash( ps + q )] : 0;
 	}
 
-	if(true
-		&& 'w' != fmode[0] 
-		&& 'r' != fmode[0]
-	//	&& 'a' != fmode[0] // not supported
-	)
+	/*
+		sum the counts of the d-grams of the segment at pos, with clear
+		they are cleared as they are summed so a repeat counts once
+	*/
+	unsigned long long segment( const size_t pos, const bool clear )
 	{
-		lz4ferr = lz4f_bad_arg;
-		return NULL;
+		unsigned long long sum = 0;
+		size_t s = (std::upper_bound( offs, offs + n + 1, pos ) - offs) - 1;
+		for(size_t q=pos; q + LZ4F_TRAIN_D <= pos + LZ4F_TRAIN_K; ++q)
+		{
+			while(offs[s+1] <= q)
+				++s;
+			if(q + LZ4F_TRAIN_D > offs[s+1])
+				continue;
+			unsigned int h = hash( ps + q );
+			sum += cnt[h];
+			if(clear)
+				cnt[h] = 0;
+		}
+		return sum;
 	}
 
-	int compression_level=9;
-	if(true
-		&&  0  != fmode[1]
-		&& 'b' != fmode[1]
-	)
+	void work_count()
 	{
-		if('w' == fmode[0])
+		// counts then the last sample plus one that each d-gram was seen in
+		unsigned int* c = new unsigned int[ 2 << LZ4F_TRAIN_LOG ];
+		if(NULL==c)
+		{
+			failed = true;
+			return;
+		}
+		unsigned int* last = c + (1 << LZ4F_TRAIN_LOG);
+		memset( c, 0, sizeof(unsigned int) * (2 << LZ4F_TRAIN_LOG) );
+		for(size_t i; n > (i = take()); )
 		{
-			if(!isdigit(fmode[1]))
+			for(size_t q=offs[i]; q + LZ4F_TRAIN_D <= offs[i+1]; ++q)
 			{
-				lz4ferr = lz4f_bad_arg;
-				return NULL;
+				unsigned int h = hash( ps + q );
+				if(last[h] != (unsigned int)(i + 1))
+				{
+					last[h] = (unsigned int)(i + 1);
+					++c[h];
+				}
 			}
-			compression_level = fmode[1]-'0';
 		}
+		std::lock_guard<std::mutex> lock(m);
+		for(size_t h=0; h < ((size_t)1 << LZ4F_TRAIN_LOG); ++h)
+			cnt[h] += c[h];
+		delete [] c;
 	}
 
-	FILE* fp = fopen(fname,('w'==fmode[0])?"wb":"rb");
-	if(NULL==fp)
+	void work_offer()
 	{
-		lz4ferr = lz4f_fail_open;
-		return NULL;
+		unsigned int* f = NULL;
+		size_t nf = 0;
+		for(size_t e; ne > (e = take()); )
+		{
+			size_t b = offs[n] / ne * e;
+			size_t z = (e + 1 == ne) ? offs[n] : offs[n] / ne * (e + 1);
+			if(nf < z - b)
+			{
+				delete [] f;
+				nf = z - b;
+				f = new unsigned int[nf];
+				if(NULL==f)
+				{
+					failed = true;
+					return;
+				}
+			}
+			// the count of the d-gram at each position of the epoch
+			size_t s = (std::upper_bound( offs, offs + n + 1, b ) - offs) - 1;
+			for(size_t q=b; q<z; ++q)
+			{
+				while(offs[s+1] <= q)
+					++s;
+				f[q-b] = at( q, offs[s+1] );
+			}
+			lz4f_offer_s* pe = po + e*LZ4F_TRAIN_OFFERS;
+			for(int k=0; k<LZ4F_TRAIN_OFFERS; ++k)
+			{
+				pe[k].score = 0;
+				pe[k].pos = b;
+				// slide a window of the d-grams of one segment over the epoch
+				const size_t w = LZ4F_TRAIN_K - LZ4F_TRAIN_D + 1;
+				unsigned long long sum = 0;
+				for(size_t q=b; q<z; ++q)
+				{
+					sum += f[q-b];
+					if(q - b >= w)
+						sum -= f[q-b-w];
+					size_t p = q + 1 - std::min( q + 1 - b, w );
+					if(p + LZ4F_TRAIN_K > z || sum <= pe[k].score)
+						continue;
+					bool overlap = false;
+					for(int j=0; j<k; ++j)
+						overlap |= (p < pe[j].pos + LZ4F_TRAIN_K && pe[j].pos < p + LZ4F_TRAIN_K);
+					if(!overlap)
+					{
+						pe[k].score = sum;
+						pe[k].pos = p;
+					}
+				}
+				if(0==pe[k].score)
+					break;
+			}
+		}
+		delete [] f;
 	}
 
-	lz4f_header_s h = lz4f_init_header();
-	assert( true == h.is_valid_header_signature() );
+	// sample bytes and their compressed size, for lz4dict_ratio
+	const lz4f_dict_s*	prime;
+	int					complvl;
+	unsigned long long	rawsize;
+	unsigned long long	packsize;
 
-	if('r'==fmode[0])
+	void work_ratio()
 	{
-		size_t result = fread( &h, sizeof(h), 1, fp );
-		if(false
-			|| 1!=result
-			|| false == h.is_valid_header_signature()
-		)
+		lz4f_cstate_s cs;
+		char* dst = new char[ LZ4_compressBound(64*1024) ];
+		if(NULL==dst || !cs.init( complvl, false, 0, prime ))
 		{
-			lz4ferr = lz4f_bad_header;
-			fclose(fp);
-			return NULL;
+			delete [] dst;
+			failed = true;
+			return;
 		}
-	}
-	else
-	if('w'==fmode[0])
-	{
-		size_t result = fwrite( &h, sizeof(h), 1, fp );
-		if(1!=result)
+		unsigned long long nr = 0, np = 0;
+		for(size_t i; n > (i = take()); )
 		{
-			lz4ferr = lz4f_fail_write;
-			fclose(fp);
-			return NULL;
+			// samples are written as one block of up to 64KB after another
+			for(size_t q=offs[i]; q<offs[i+1]; )
+			{
+				int k = (int)std::min( offs[i+1] - q, (size_t)64*1024 );
+				int c = cs.compress( (const char*)ps + q, dst, k, LZ4_compressBound(64*1024) );
+				nr += k;
+				np += sizeof(lz4f_sizes_s) + ((0 < c && c < k) ? c : k);
+				q += k;
+			}
 		}
+		std::lock_guard<std::mutex> lock(m);
+		rawsize += nr;
+		packsize += np;
+		delete [] dst;
 	}
-	else
+
+	bool set_samples( const void* psamples, const size_t* psizes, const size_t nsamples )
 	{
-		assert(false);
+		ps = (const unsigned char*)psamples;
+		n = nsamples;
+		offs = new size_t[n+1];
+		if(NULL==offs)
+			return false;
+		offs[0] = 0;
+		for(size_t i=0; i<n; ++i)
+			offs[i+1] = offs[i] + psizes[i];
+		return true;
 	}
+};
 
-	lz4File f = new lz4File_s;
-	if(NULL==f)
+size_t lz4dict_train ( void* pdict, const size_t ndict, const void* psamples, const size_t* psizes, const size_t nsamples, const int threads )
+{
+	if(NULL==pdict || 0==ndict || NULL==psamples || NULL==psizes || 0==nsamples || 0>threads)
 	{
-		lz4ferr = lz4f_fail_heap;
-		fclose(fp);
-		return NULL;
+		lz4ferr = lz4f_bad_arg;
+		return 0;
 	}
-	lz4f_buffers_s* pb = new lz4f_buffers_s;
-	if(NULL==pb)
+	lz4f_train_s t;
+	if(!t.set_samples( psamples, psizes, nsamples ))
 	{
 		lz4ferr = lz4f_fail_heap;
-		delete f;
-		fclose(fp);
-		return NULL;
+		return 0;
 	}
-
-	f->fp = fp;
-	f->pb = pb;
-	f->pb->init(fmode[0],compression_level);
-	f->h = h;
-
 	lz4ferr = lz4f_ok;
-
-	return f;
-}
-
-size_t lz4write	( lz4File f, const void* pbytes, const size_t nbytes )
-{
-	if(NULL==f || NULL==pbytes)
+	const size_t nd = std::min( ndict, (size_t)64*1024 );
+	const size_t total = t.offs[nsamples];
+	unsigned char* pd = (unsigned char*)pdict;
+	// few samples make the dictionary themselves, the last ones at the end
+	if(total <= nd)
 	{
-		lz4ferr = lz4f_bad_arg;
+		memcpy( pd, psamples, total );
+		return total;
+	}
+	const int nt = (0==threads) ? (int)get_cpu_count() : threads;
+	t.ne = std::max( std::min( nd, total ) / LZ4F_TRAIN_K, (size_t)1 );
+	t.cnt = new unsigned int[ (size_t)1 << LZ4F_TRAIN_LOG ];
+	t.po = new lz4f_offer_s[ t.ne*LZ4F_TRAIN_OFFERS ];
+	if(NULL==t.cnt || NULL==t.po)
+	{
+		lz4ferr = lz4f_fail_heap;
 		return 0;
 	}
-	if(0==nbytes)
+	memset( t.cnt, 0, sizeof(unsigned int) << LZ4F_TRAIN_LOG );
+	memset( t.po, 0, sizeof(lz4f_offer_s) * t.ne*LZ4F_TRAIN_OFFERS );
+	t.run( nt, &lz4f_train_s::work_count );
+	if(!t.failed)
+		t.run( nt, &lz4f_train_s::work_offer );
+	if(t.failed)
+	{
+		lz4ferr = lz4f_fail_heap;
 		return 0;
-
-	size_t nw = f->pb->write( f->fp, (const unsigned char*)pbytes, nbytes );
-	f->h.lz4c.content_size += nw;
-	return nw;
+	}
+	/*
+		lazy greedy, an offer whose score went down since it was pushed
+		goes back with the new score, one that kept it is the best
+	*/
+	lz4f_offer_s* heap = t.po;
+	lz4f_offer_s* heapend = t.po + t.ne*LZ4F_TRAIN_OFFERS;
+	std::make_heap( heap, heapend );
+	size_t used = 0;
+	while(heap!=heapend && 0<heap->score && used + LZ4F_TRAIN_K <= nd)
+	{
+		std::pop_heap( heap, heapend );
+		lz4f_offer_s& o = heapend[-1];
+		unsigned long long v = t.segment( o.pos, false );
+		if(v < o.score)
+		{
+			o.score = v;
+			std::push_heap( heap, heapend );
+			continue;
+		}
+		t.segment( o.pos, true );
+		used += LZ4F_TRAIN_K;
+		memcpy( pd + nd - used, t.ps + o.pos, LZ4F_TRAIN_K );
+		--heapend;
+	}
+	if(used < nd)
+		memmove( pd, pd + nd - used, used );
+	return used;
 }
 
-size_t lz4read	( lz4File f, void* pbytes, const size_t nbytes )
+double lz4dict_ratio ( const void* pdict, const size_t ndict, const void* psamples, const size_t* psizes, const size_t nsamples, const int level, const int threads )
 {
-	if(NULL==f || NULL==pbytes)
+	if((NULL==pdict && 0!=ndict) || NULL==psamples || NULL==psizes || 0==nsamples || 0>threads)
 	{
 		lz4ferr = lz4f_bad_arg;
 		return 0;
 	}
-	if(0==nbytes)
-		return 0;
-
-	size_t nr = f->pb->read( f->fp, (unsigned char*)pbytes, nbytes );
-	return nr;
-}
-
-char* lz4gets	( lz4File f, char *pbytes, const size_t nbytes )
-{
-	if(NULL==f || NULL==pbytes)
+	lz4f_dict_s dict;
+	lz4f_train_s t;
+	if(!t.set_samples( psamples, psizes, nsamples ) || !dict.set( (0==ndict) ? NULL : pdict, ndict ))
 	{
-		lz4ferr = lz4f_bad_arg;
+		lz4ferr = lz4f_fail_heap;
 		return 0;
 	}
-	if(0==nbytes)
+	t.prime = (0==ndict) ? NULL : &dict;
+	t.complvl = (LZ4F_LEVEL_MIN_HC > level) ? -1 : std::min( level, LZ4F_LEVEL_MAX_HC );
+	t.rawsize = t.packsize = 0;
+	t.run( (0==threads) ? (int)get_cpu_count() : threads, &lz4f_train_s::work_ratio );
+	if(t.failed || 0==t.packsize)
+	{
+		lz4ferr = t.failed ? lz4f_fail_heap : lz4f_bad_arg;
 		return 0;
-
-	f->pb->gets( f->fp, pbytes, nbytes );
-	return pbytes;
+	}
+	lz4ferr = lz4f_ok;
+	return (double)t.rawsize / (double)t.packsize;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -851,7 +4058,11 @@ char* lz4gets	( lz4File f, char *pbytes, const size_t nbytes )
 ///////////////////////////////////////////////////////////////////////////////
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 size_t get_page_size()
 {
@@ -868,12 +4079,144 @@ bool set_page_lock( unsigned char* a, const bool v )
 	return (0!=bresult);
 }
 
+size_t get_cpu_count()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (0<si.dwNumberOfProcessors) ? si.dwNumberOfProcessors : 1;
+}
+
+bool set_file_pos( FILE* fp, const long long off, const int whence )
+{
+	return 0==_fseeki64(fp,off,whence);
+}
+
+long long get_file_pos( FILE* fp )
+{
+	return _ftelli64(fp);
+}
+
+long long get_file_size( const int fd )
+{
+	return _filelengthi64(fd);
+}
+
+int get_file_fd( FILE* fp )
+{
+	return _fileno(fp);
+}
+
+FILE* open_file_fdopen( const int fd, const char* fmode )
+{
+	return _fdopen(fd,fmode);
+}
+
+/*
+	fclose closes the descriptor under fp as well, so a copy of it
+	is put back in its place, which only the error path pays for
+*/
+void close_file_keep_fd( FILE* fp, const int fd )
+{
+	int fd2 = _dup(fd);
+	fclose(fp);
+	if(0<=fd2)
+	{
+		_dup2(fd2,fd);
+		_close(fd2);
+	}
+}
+
+int open_file_fd( const char* fname, const char fmode )
+{
+	if('a'==fmode)
+		return _open(fname,_O_WRONLY|_O_CREAT|_O_APPEND|_O_BINARY,_S_IREAD|_S_IWRITE);
+	return ('w'==fmode)
+		? _open(fname,_O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY,_S_IREAD|_S_IWRITE)
+		: _open(fname,_O_RDONLY|_O_BINARY);
+}
+
+void close_file_fd( const int fd )
+{
+	_close(fd);
+}
+
+long long seek_file_fd( const int fd, const long long off, const int whence )
+{
+	return _lseeki64(fd,off,whence);
+}
+
+/*
+	there is no vectored read or write on a crt descriptor,
+	so q is only read after p is full and never read ahead
+*/
+size_t read_file_v( const int fd, void* p, const size_t n, void* q, const size_t m )
+{
+	int nr = _read(fd,p,(unsigned int)std::min(n,(size_t)0x40000000));
+	return (0<nr) ? (size_t)nr : 0;
+}
+
+size_t write_file_v( const int fd, const void* p, const size_t n, const void* q, const size_t m )
+{
+	int nw = _write(fd,p,(unsigned int)std::min(n,(size_t)0x40000000));
+	if(0>=nw)
+		return 0;
+	if((size_t)nw < n || 0==m)
+		return (size_t)nw;
+	int nq = _write(fd,q,(unsigned int)std::min(m,(size_t)0x40000000));
+	return (size_t)nw + ((0<nq) ? (size_t)nq : 0);
+}
+
+/*
+	an overlapped read on a handle opened for synchronous use
+	also moves the file pointer, so sequential reads on the same
+	lz4File should not run next to lz4pread on Windows
+*/
+bool read_file_at( const int fd, void* p, const size_t n, const unsigned long long off )
+{
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	OVERLAPPED o;
+	memset(&o,0,sizeof(o));
+	o.Offset = (DWORD)off;
+	o.OffsetHigh = (DWORD)(off>>32);
+	DWORD nr = 0;
+	return ReadFile(h,p,(DWORD)n,&nr,&o) && n==nr;
+}
+
+const unsigned char* map_file( const int fd, size_t& z )
+{
+	long long zf = get_file_size(fd);
+	if(0 >= zf || (unsigned long long)zf != (size_t)zf)
+		return NULL;
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	HANDLE hm = CreateFileMapping(h,NULL,PAGE_READONLY,0,0,NULL);
+	if(NULL==hm)
+		return NULL;
+	// the view keeps the mapping object alive
+	void* p = MapViewOfFile(hm,FILE_MAP_READ,0,0,0);
+	CloseHandle(hm);
+	if(NULL==p)
+		return NULL;
+	z = (size_t)zf;
+	return (const unsigned char*)p;
+}
+
+void unmap_file( const unsigned char* p, const size_t z )
+{
+	UnmapViewOfFile(p);
+}
+
 #else
 
 // GNU GCC specific functions
 
 #include <unistd.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
 size_t get_page_size()
 {
 	return getpagesize();
@@ -888,6 +4231,200 @@ bool set_page_lock( unsigned char* a, const bool v )
 	return (0==iresult);
 }
 
+bool set_file_pos( FILE* fp, const long long off, const int whence )
+{
+	return 0==fseeko(fp,(off_t)off,whence);
+}
+
+long long get_file_pos( FILE* fp )
+{
+	return (long long)ftello(fp);
+}
+
+long long get_file_size( const int fd )
+{
+	struct stat st;
+	if(0!=fstat(fd,&st))
+		return -1;
+	return (long long)st.st_size;
+}
+
+int get_file_fd( FILE* fp )
+{
+	return fileno(fp);
+}
+
+FILE* open_file_fdopen( const int fd, const char* fmode )
+{
+	return fdopen(fd,fmode);
+}
+
+/*
+	fclose closes the descriptor under fp as well, so a copy of it
+	is put back in its place, which only the error path pays for
+*/
+void close_file_keep_fd( FILE* fp, const int fd )
+{
+	int fd2 = dup(fd);
+	fclose(fp);
+	if(0<=fd2)
+	{
+		dup2(fd2,fd);
+		close(fd2);
+	}
+}
+
+int open_file_fd( const char* fname, const char fmode )
+{
+	if('a'==fmode)
+		return open(fname,O_WRONLY|O_CREAT|O_APPEND,0666);
+	return ('w'==fmode)
+		? open(fname,O_WRONLY|O_CREAT|O_TRUNC,0666)
+		: open(fname,O_RDONLY);
+}
+
+void close_file_fd( const int fd )
+{
+	close(fd);
+}
+
+long long seek_file_fd( const int fd, const long long off, const int whence )
+{
+	return (long long)lseek(fd,(off_t)off,whence);
+}
+
+// one readv filling p first, then as much of q as is there
+size_t read_file_v( const int fd, void* p, const size_t n, void* q, const size_t m )
+{
+	struct iovec v[2] = { { p, n }, { q, m } };
+	ssize_t nr;
+	do
+		nr = readv(fd,v,(0<m) ? 2 : 1);
+	while(0>nr && EINTR==errno);
+	return (0<nr) ? (size_t)nr : 0;
+}
+
+size_t write_file_v( const int fd, const void* p, const size_t n, const void* q, const size_t m )
+{
+	struct iovec v[2] = { { (void*)p, n }, { (void*)q, m } };
+	ssize_t nw;
+	do
+		nw = writev(fd,v,(0<m) ? 2 : 1);
+	while(0>nw && EINTR==errno);
+	return (0<nw) ? (size_t)nw : 0;
+}
+
+const unsigned char* map_file( const int fd, size_t& z )
+{
+	long long zf = get_file_size(fd);
+	if(0 >= zf || (unsigned long long)zf != (size_t)zf)
+		return NULL;
+	void* p = mmap(NULL,(size_t)zf,PROT_READ,MAP_PRIVATE,fd,0);
+	if(MAP_FAILED==p)
+		return NULL;
+	// blocks are walked front to back so let the kernel read ahead
+	madvise(p,(size_t)zf,MADV_SEQUENTIAL);
+	z = (size_t)zf;
+	return (const unsigned char*)p;
+}
+
+void unmap_file( const unsigned char* p, const size_t z )
+{
+	munmap((void*)p,z);
+}
+
+bool read_file_at( const int fd, void* p, const size_t n, const unsigned long long off )
+{
+	size_t done = 0;
+	while(done < n)
+	{
+		ssize_t nr = ::pread( fd, (char*)p + done, n - done, (off_t)(off + done) );
+		if(0 >= nr)
+			return false;
+		done += nr;
+	}
+	return true;
+}
+
+/*
+	read the cgroup cpu quota as a whole number of cpus
+	returns 0 when there is no quota or no cgroup
+*/
+size_t get_cgroup_cpu_quota()
+{
+	long long quota = -1;
+	long long period = 0;
+	char path[512];
+	char line[512];
+
+	// cgroup v2 keeps "quota period" in cpu.max of our own group
+	strcpy(path,"/sys/fs/cgroup/cpu.max");
+	FILE* fp = fopen("/proc/self/cgroup","r");
+	if(NULL!=fp)
+	{
+		while(NULL!=fgets(line,sizeof(line),fp))
+		{
+			if(0!=strncmp(line,"0::/",4))
+				continue;
+			line[strcspn(line,"\n")]=0;
+			if(sizeof(path) <= (size_t)snprintf(path,sizeof(path),"/sys/fs/cgroup%s/cpu.max",line+3))
+				strcpy(path,"/sys/fs/cgroup/cpu.max");
+			break;
+		}
+		fclose(fp);
+	}
+	fp = fopen(path,"r");
+	if(NULL==fp)
+		fp = fopen("/sys/fs/cgroup/cpu.max","r");
+	if(NULL!=fp)
+	{
+		char sq[32];
+		if(2==fscanf(fp,"%31s %lld",sq,&period) && isdigit(sq[0]))
+			quota = atoll(sq);
+		fclose(fp);
+	}
+	else
+	{
+		// cgroup v1 keeps them in two files
+		fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us","r");
+		if(NULL!=fp)
+		{
+			if(1!=fscanf(fp,"%lld",&quota))
+				quota = -1;
+			fclose(fp);
+		}
+		fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us","r");
+		if(NULL!=fp)
+		{
+			if(1!=fscanf(fp,"%lld",&period))
+				period = 0;
+			fclose(fp);
+		}
+	}
+	if(0>=quota || 0>=period)
+		return 0;
+	return (size_t)((quota + period - 1) / period);
+}
+
+size_t get_cpu_count()
+{
+	size_t n = 0;
+#ifdef CPU_COUNT
+	cpu_set_t cs;
+	if(0==sched_getaffinity(0,sizeof(cs),&cs))
+		n = CPU_COUNT(&cs);
+#endif
+	if(0==n)
+	{
+		long l = sysconf(_SC_NPROCESSORS_ONLN);
+		n = (0<l) ? (size_t)l : 1;
+	}
+	size_t q = get_cgroup_cpu_quota();
+	if(0<q && q<n)
+		n = q;
+	return n;
+}
+
 #endif
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -46,6 +46,7 @@ typedef enum {
 	,lz4f_bad_arg			= -1
 	,lz4f_bad_header		= -2
 	,lz4f_bad_frame			= -3
+	,lz4f_bad_dict			= -4
 	//...
 	,lz4f_fail_heap			= -10
 	,lz4f_fail_open			= -11
@@ -151,9 +152,10 @@ struct lz4f_header_s
 
 
 struct lz4f_buffers_s;
+struct lz4f_io_s;
 struct lz4File_s
 {
-	FILE* fp; // standard C-RTL FILE
+	lz4f_io_s* io; // FILE, descriptor, memory or callbacks
 	lz4f_buffers_s* pb; // lz4f buffers
 	lz4f_header_s h; // lz4f header 
 };
@@ -168,13 +170,104 @@ typedef lz4File_s* lz4File;
 			valid fmode strings are:
 			"r" "rb"
 			"w" "wb"
+			"a" "ab"
 			"w0" "w1" "w2" "w3" "w4" 
 			"w5" "w6" "w7" "w8" "w9" 
-			For the "wN" modes the value of N is passed directly
-			to the lz4 compression function and the interpretation
-			is entirely subject to the lz4 source code.
+			"w10" ... "w16"
+			"wf" "wf1" "wf2" ... "wfA"
+			For the "wN" modes with N from 3 to 16 the value of N
+			is passed directly to the lz4 high compression function
+			and the interpretation is entirely subject to the lz4 
+			source code.  As with the lz4 command line tool the
+			levels 0, 1 and 2 use the fast lz4 compressor instead.
 			The default value of N is 9 (high compression) for
 			modes "w" and "wb"
+			The "wfA" modes use the fast lz4 compressor with an
+			acceleration of A, where larger values trade ratio for
+			speed.  "wf" and "wf1" are the default acceleration.
+			A is at most 65536.
+
+			Any write mode may include "BN" to select the block size
+			where N is the b_maxsize value recorded in the header:
+				"B2" 4KB    "B3" 16KB   "B4" 64KB (default)
+				"B5" 256KB  "B6" 1MB    "B7" 4MB
+			Smaller blocks lower the latency of streaming readers,
+			larger blocks cut per block overhead and improve ratio.
+			Readers size their buffers from the header.
+
+			Any write mode may include "BD" to link the blocks, so
+			each block can refer to the previous 64KB of input.
+			This improves the ratio of small blocks and repetitive
+			data, clears b_independent in the header and is read
+			back automatically.  Linked blocks are compressed and
+			decoded in order on the calling thread, "tT" is ignored.
+
+			Any write mode may be followed by "tT" where T is the
+			number of worker threads that compress blocks while
+			the caller keeps writing, for example "w9t4".
+			A bare "t" uses one thread per cpu available to the
+			process, honouring a cgroup cpu quota when present.
+			T is capped at four threads per cpu.
+			Blocks are still written to the file strictly in order
+			and the file format is unchanged.
+
+			Output that cannot seek, such as a pipe, is written as a
+			stream: the header is written once up front and the
+			content size travels after the end mark instead of
+			being patched into the header on close.  Any write mode
+			may include "s" to ask for this on a regular file too.
+			Readers accept both forms.
+
+			Read modes accept the same "tT" suffix, for example "rt2".
+			The workers read ahead and decompress upcoming blocks
+			while the caller consumes the current one.  "rt1" uses a
+			single background reader which still overlaps file reads
+			and decompression with the caller.
+
+			Read modes may include "m" to map the file into memory,
+			for example "rm".  Blocks are then decoded straight from
+			the mapping and stored blocks are handed out in place,
+			with no copy through a staging buffer and no stdio
+			locking.  Mapped files are decoded on the calling
+			thread, "tT" is ignored, and a file that cannot be
+			mapped is read as usual.
+
+			Any write mode may include "F" to write a standard lz4
+			frame, magic number 0x184D2204, as the lz4 command line
+			tool and lz4frame write it, for example "w9F".  The
+			"BN" block size (64KB at least), "BD" and the level
+			carry over, "fA" runs at the default acceleration and
+			"tT" is ignored.  The frame keeps a content checksum.
+			Read modes recognise such frames, including several
+			frames back to back, and read them with the same calls.
+			lz4seek works by decoding forward, or again from the
+			start, and lz4pread needs the lz4f format.
+
+			Any mode may include "u" to do the file i/o straight on
+			a descriptor without stdio, for example "w9u" or "rut2".
+			Each block is then written with one gathered write and
+			read with one call that also fetches the header of the
+			next block, with no stdio buffer or lock in between.
+			lz4dopen honours "u" as well.
+
+			"a" takes any write mode letters, for example "a9B3",
+			and writes a new frame after the end of the file, so
+			adding to a log costs only the bytes added.  The new
+			frame is written as a stream, as for "s", and may use
+			other block settings than the frames before it.
+			Read modes go on from one frame to the next, whether
+			written by "a" or joined as by cat a.lz4 b.lz4 > c.lz4,
+			and lz4read returns them as one uncompressed stream.
+			Frames whose blocks differ from those of the first frame
+			are read on the calling thread.
+
+			Read modes serve input that is neither lz4f nor a
+			standard frame as it is, as gzread does, including input
+			shorter than a header.  lz4read, lz4gets, lz4seek and
+			lz4pread then work on the raw bytes.  With "m", or
+			through lz4memopen, the bytes are handed out straight
+			from memory, otherwise each read is one large call on
+			the file with no decompression in between.
 
 	Return value:
 		On error, NULL is returned and lz4ferr contains details.
@@ -183,6 +276,186 @@ typedef lz4File_s* lz4File;
 lz4File lz4open ( const char * fname, const char * fmode );
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+/*
+	lz4File lz4dopen ( const int fd, const char * fmode );
+	lz4File lz4fopen ( FILE* fp, const char * fmode );
+
+	fd	: an open file descriptor, as for gzdopen
+	fp	: an open standard C-RTL FILE
+	fmode: any fmode accepted by lz4open
+
+	The stream starts at the current position of fd or fp, so
+	an lz4 stream can follow other data in the same file.
+	Writes to a descriptor or FILE that cannot seek, such as a
+	pipe or a socket, are streamed as described for lz4open.
+
+	fd itself is used, not a copy of it, so it stays taken until
+	lz4close.  On success the lz4File owns fd or fp and lz4close
+	closes it.  On error, fd or fp is left open and belongs to the
+	caller.
+
+	Return value:
+		On error, NULL is returned and lz4ferr contains details.
+		On success, a heap allocated lz4File struct is returned
+*/
+lz4File lz4dopen ( const int fd, const char * fmode );
+lz4File lz4fopen ( FILE* fp, const char * fmode );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	lz4File lz4memopen ( const void * pbytes, const size_t nbytes, const char * fmode );
+	lz4File lz4memopen_grow ( void ** ppbytes, size_t * pnbytes, const char * fmode );
+
+	pbytes	: nbytes of an lz4 stream in memory
+	ppbytes	: NULL or a buffer from malloc to write into
+	pnbytes	: the capacity of *ppbytes
+	fmode	: a read fmode for lz4memopen, a write fmode for
+			  lz4memopen_grow, as accepted by lz4open
+
+	The stream has the same format as a file and is read and
+	written with the same calls.  No file system is involved.
+
+	lz4memopen decodes the blocks straight from pbytes as the "m"
+	read mode does, pbytes must stay valid until lz4close.
+
+	lz4memopen_grow writes into *ppbytes, which is grown with
+	realloc as needed, so a buffer kept from an earlier stream
+	saves the reallocs.  With "a" the *pnbytes bytes already in
+	*ppbytes are kept and the new frame is written after them.
+	lz4close stores the buffer in *ppbytes and the stream length
+	in *pnbytes, the caller frees the buffer with free.  On error
+	*ppbytes and *pnbytes are updated as by lz4close.
+
+	Return value:
+		On error, NULL is returned and lz4ferr contains details.
+		On success, a heap allocated lz4File struct is returned
+*/
+lz4File lz4memopen ( const void * pbytes, const size_t nbytes, const char * fmode );
+lz4File lz4memopen_grow ( void ** ppbytes, size_t * pnbytes, const char * fmode );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	callbacks for lz4open_io, user is the pointer given to lz4open_io
+
+	read	: copy up to nbytes into pbytes, return the count or 0
+			  at the end or on error, required for reading
+	write	: take up to nbytes from pbytes, return the count or 0
+			  on error, required for writing
+	seek	: move as fseek does and return the new offset or -1,
+			  NULL when the stream cannot seek
+	close	: called by lz4close, may be NULL
+
+	Short counts from read and write are retried.  The callbacks
+	of one lz4File are never called at the same time, but they may
+	be called from the worker threads of the "tT" modes.
+*/
+struct lz4f_io_vtable_s
+{
+	size_t		(*read)	( void* user, void* pbytes, size_t nbytes );
+	size_t		(*write)( void* user, const void* pbytes, size_t nbytes );
+	long long	(*seek)	( void* user, long long off, int whence );
+	int			(*close)( void* user );
+};
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	lz4File lz4open_io ( const lz4f_io_vtable_s * vt, void * user, const char * fmode );
+
+	vt		: the callbacks, they must stay valid until lz4close
+	user	: passed unchanged to every callback
+	fmode	: any fmode accepted by lz4open
+
+	The stream has the same format as a file.  It starts at the
+	current offset of the callbacks.  Without seek the output is
+	streamed as for a pipe, and lz4seek can only move forward.
+	With seek, lz4seek and lz4pread use the block index.
+
+	Return value:
+		On error, NULL is returned and lz4ferr contains details.
+		The close callback is not called on error.
+		On success, a heap allocated lz4File struct is returned
+*/
+lz4File lz4open_io ( const lz4f_io_vtable_s * vt, void * user, const char * fmode );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	lz4File lz4open_dict ( const char * fname, const char * fmode, const void * pdict, const size_t ndict );
+	unsigned int lz4dictid ( lz4File f );
+	unsigned int lz4dictid_of ( const void * pdict, const size_t ndict );
+
+	pdict	: a dictionary of sample content, only the last 64KB
+			  are used, it is copied and may be freed after open
+	ndict	: the size of pdict in bytes
+	f		: a valid lz4File structure returned by lz4open
+
+	lz4open_dict opens fname as lz4open does.  Writing, every
+	block is compressed as if the dictionary came right before
+	it, which helps most when the content is many small similar
+	records.  The header records the id of the dictionary.
+	Linked blocks refer to it from the first block on.  "F" is
+	not supported with a dictionary.
+
+	Reading, pdict must be the dictionary the file was written
+	with, otherwise open fails with lz4f_bad_dict.  A file that
+	was written without a dictionary is read as usual.
+
+	lz4dictid returns the dictionary id in the header of f, or
+	0 when the file needs no dictionary.  A file that needs one
+	still opens with lz4open so a reader can look the id up, and
+	then reopen it with lz4open_dict.  Reads without it fail with
+	lz4f_bad_dict.  lz4dictid_of returns the id a dictionary is
+	recorded under.
+
+	Return value:
+		lz4open_dict returns NULL on error and lz4ferr contains
+		details, on success a heap allocated lz4File struct.
+		lz4dictid and lz4dictid_of return the id, or 0 with
+		lz4ferr set on error.
+*/
+lz4File lz4open_dict ( const char * fname, const char * fmode, const void * pdict, const size_t ndict );
+unsigned int lz4dictid ( lz4File f );
+unsigned int lz4dictid_of ( const void * pdict, const size_t ndict );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	size_t lz4dict_train ( void * pdict, const size_t ndict, const void * psamples, const size_t * psizes, const size_t nsamples, const int threads );
+	double lz4dict_ratio ( const void * pdict, const size_t ndict, const void * psamples, const size_t * psizes, const size_t nsamples, const int level, const int threads );
+
+	pdict		: the dictionary, for lz4dict_ratio NULL for none
+	ndict		: the size of pdict, a dictionary is at most 64KB
+	psamples	: the samples back to back
+	psizes		: the size of each sample
+	nsamples	: the number of samples
+	level		: the compression level as in "wN"
+	threads		: the worker threads to use, 0 for one per cpu
+
+	lz4dict_train builds a dictionary for lz4open_dict out of the
+	segments that occur in the most samples.  Samples are best
+	the size of the records the files will hold, and all together
+	at least ten times ndict.  When they do not fill ndict they
+	are the dictionary themselves.
+
+	lz4dict_ratio compresses every sample on its own, as blocks
+	of up to 64KB are written with the dictionary, and returns
+	the ratio of sample bytes to block bytes.  Measure it on
+	samples that were not trained on, with and without pdict,
+	to see whether the dictionary pays off.
+
+	Return value:
+		lz4dict_train returns the size of the dictionary written
+		to pdict, lz4dict_ratio the ratio, both 0 with lz4ferr
+		set on error.
+*/
+size_t lz4dict_train ( void * pdict, const size_t ndict, const void * psamples, const size_t * psizes, const size_t nsamples, const int threads );
+double lz4dict_ratio ( const void * pdict, const size_t ndict, const void * psamples, const size_t * psizes, const size_t nsamples, const int level, const int threads );
+///////////////////////////////////////////////////////////////////////////////
+
 ///////////////////////////////////////////////////////////////////////////////
 /*
 	int lz4close	( lz4File f );
@@ -211,6 +484,37 @@ int lz4close	( lz4File f );
 size_t lz4write	( lz4File f, const void* pbytes, const size_t nbytes );
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+/*
+	void* lz4write_reserve	( lz4File f, const size_t nbytes );
+	size_t lz4write_commit	( lz4File f, const size_t nbytes );
+
+	f		: a valid lz4File structure returned by lz4open for writing
+	nbytes	: for lz4write_reserve the number of bytes needed, at most
+			  the block size of f
+			  for lz4write_commit the number of bytes actually written,
+			  at most the space handed out by lz4write_reserve
+
+	Return value of lz4write_reserve:
+		On error, return value is NULL and lz4ferr contains details.
+		On success, return value points to at least nbytes of 
+		writable space inside the current uncompressed block.
+
+	Return value of lz4write_commit:
+		On error, return value is 0 and lz4ferr contains details.
+		On success, return value is nbytes and lz4ferr = lz4f_ok
+
+	Together these let a caller format data straight into the block
+	that will be compressed instead of into its own buffer followed 
+	by lz4write.  When less than nbytes is left in the current block
+	it is compressed early and a fresh block is handed out.  
+	The reserved space is only valid until the next call on f.
+
+*/
+void* lz4write_reserve	( lz4File f, const size_t nbytes );
+size_t lz4write_commit	( lz4File f, const size_t nbytes );
+///////////////////////////////////////////////////////////////////////////////
+
 ///////////////////////////////////////////////////////////////////////////////
 /*
 	size_t lz4read	( lz4File f, void* pbytes, const size_t nbytes );
@@ -222,6 +526,8 @@ size_t lz4write	( lz4File f, const void* pbytes, const size_t nbytes );
 	Return value:
 		On error, return value is 0 and lz4ferr contains details.
 		On success, return value is nbytes and lz4ferr = lz4f_ok
+		At end-of-file the return value may be less than nbytes,
+		lz4ferr = lz4f_ok and lz4eof returns non-zero.
 
 */
 size_t lz4read	( lz4File f, void* pbytes, const size_t nbytes );
@@ -237,6 +543,8 @@ size_t lz4read	( lz4File f, void* pbytes, const size_t nbytes );
 
 	Return value:
 		On error, return value is NULL and lz4ferr contains details.
+		At end-of-file with no bytes read, return value is NULL 
+		and lz4ferr = lz4f_ok.
 		On success, return value is pbytes and lz4ferr = lz4f_ok
 
 	lz4gets reads a maximum of nbytes-1 from file f but will stop
@@ -248,6 +556,185 @@ size_t lz4read	( lz4File f, void* pbytes, const size_t nbytes );
 char * lz4gets	( lz4File f, char *pbytes, const size_t nbytes );
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+/*
+	size_t lz4getdelim	( lz4File f, char *pbytes, const size_t nbytes, const int delim );
+
+	f		: a valid lz4File structure returned by lz4open for reading
+	pbytes	: pointer to writable destination buffer
+	nbytes	: the byte length of the pbytes buffer
+	delim	: the byte value that ends a record, for example '\n', 0
+			  or 0x1E
+
+	Return value:
+		On error, return value is 0 and lz4ferr contains details.
+		At end-of-file with no bytes read, return value is 0
+		and lz4ferr = lz4f_ok.
+		On success, return value is the number of bytes stored
+		including delim but not the terminating 0 byte.
+
+	lz4getdelim works like lz4gets with any delimiter.  The length
+	is returned because records ending in a 0 byte or holding 0
+	bytes cannot be measured with strlen.
+
+*/
+size_t lz4getdelim	( lz4File f, char *pbytes, const size_t nbytes, const int delim );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	int lz4read_view	( lz4File f, const void** ppbytes, size_t* pnbytes );
+
+	f		: a valid lz4File structure returned by lz4open for reading
+	ppbytes	: receives a pointer to the next decompressed bytes
+	pnbytes	: receives the number of bytes available at *ppbytes
+
+	Return value:
+		On error, return value is negative and lz4ferr contains details.
+		On success, return value is 0 and lz4ferr = lz4f_ok
+		At end-of-file *pnbytes is 0 and lz4eof returns non-zero.
+
+	lz4read_view returns the rest of the current decompressed block
+	without copying it and advances the read position past it.
+	The bytes belong to the lz4File and stay valid only until the
+	next call on f.  It may be mixed freely with lz4read and lz4gets.
+
+*/
+int lz4read_view	( lz4File f, const void** ppbytes, size_t* pnbytes );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	long long lz4seek	( lz4File f, const long long off, const int whence );
+	long long lz4tell	( lz4File f );
+
+	f		: a valid lz4File structure returned by lz4open, 
+			  lz4seek needs one opened for reading
+	off		: uncompressed offset relative to whence
+	whence	: SEEK_SET, SEEK_CUR or SEEK_END as for fseek
+
+	Return value:
+		On error, return value is -1 and lz4ferr contains details.
+		On success, return value is the uncompressed offset of
+		the next byte to be read or written and lz4ferr = lz4f_ok
+
+	lz4close appends an index of the blocks after the end mark.
+	lz4seek uses it to jump straight to the block holding the
+	target and decodes only that block.  Files without an index
+	and files with linked blocks are still seekable but lz4seek
+	then decodes its way to the target, from the start of the
+	file when moving backward.  Seeking past the end stops at
+	the end and returns that offset.  SEEK_END on a stream
+	without a recorded content size decodes to the end first.
+	A file of several frames ends with the index of its last
+	frame only, so it is read as a file without an index.
+
+*/
+long long lz4seek	( lz4File f, const long long off, const int whence );
+long long lz4tell	( lz4File f );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	size_t lz4pread	( lz4File f, void* pbytes, const size_t nbytes, const long long off );
+
+	f		: a valid lz4File structure returned by lz4open for reading
+	pbytes	: pointer to writable destination buffer
+	nbytes	: the number of bytes to read
+	off		: uncompressed offset of the first byte to read
+
+	Return value:
+		On error, return value is 0 and lz4ferr contains details.
+		On success, return value is the number of bytes read, less
+		than nbytes only at end-of-file, and lz4ferr = lz4f_ok
+
+	lz4pread reads through the block index with positional reads
+	and its own decode buffers.  It does not move the position
+	used by lz4read, and any number of threads may call it at once
+	on the same f.  It needs a file of one frame with an index
+	and independent blocks and fails with lz4f_bad_arg otherwise.
+
+*/
+size_t lz4pread	( lz4File f, void* pbytes, const size_t nbytes, const long long off );
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/*
+	int lz4getdelim_view	( lz4File f, const char** ppbytes, size_t* pnbytes, const int delim );
+
+	f		: a valid lz4File structure returned by lz4open for reading
+	ppbytes	: receives a pointer to the next record
+	pnbytes	: receives the length of the record including delim
+	delim	: the byte value that ends a record, for example '\n'
+
+	Return value:
+		On error, return value is negative and lz4ferr contains details.
+		On success, return value is 0 and lz4ferr = lz4f_ok
+		At end-of-file *pnbytes is 0 and lz4eof returns non-zero.
+
+	lz4getdelim_view returns the next record without copying it when
+	it lies inside one decompressed block.  A record that crosses
+	a block boundary is gathered into a side buffer owned by f.
+	The last record of the file may lack delim.  As with
+	lz4read_view the bytes are not 0 terminated and stay valid only
+	until the next call on f.
+
+	lz4f_lines_s wraps it for range-for loops:
+
+		for( lz4f_line_s line : lz4f_lines_s(f) )
+			tokenize( line.p, line.n );
+
+	The loop stops at end-of-file or on error, check lz4ferr after.
+
+*/
+int lz4getdelim_view	( lz4File f, const char** ppbytes, size_t* pnbytes, const int delim );
+
+struct lz4f_line_s
+{
+	const char*	p;	// first byte of the record
+	size_t		n;	// length including the delimiter
+};
+
+struct lz4f_lines_s
+{
+	lz4File	f;
+	int		delim;
+
+	explicit lz4f_lines_s( lz4File file, const int d = '\n' ):f(file),delim(d)
+	{
+	}
+
+	struct iterator
+	{
+		lz4f_lines_s*	pl;		// NULL at the end
+		lz4f_line_s		line;	// current record
+
+		void next()
+		{
+			if(0!=lz4getdelim_view( pl->f, &line.p, &line.n, pl->delim ) || 0==line.n)
+				pl = NULL;
+		}
+		const lz4f_line_s& operator*() const { return line; }
+		const lz4f_line_s* operator->() const { return &line; }
+		iterator& operator++() { next(); return *this; }
+		bool operator!=( const iterator& b ) const { return pl != b.pl; }
+		bool operator==( const iterator& b ) const { return pl == b.pl; }
+	};
+
+	iterator begin()
+	{
+		iterator i = { this, { NULL, 0 } };
+		i.next();
+		return i;
+	}
+	iterator end()
+	{
+		iterator i = { NULL, { NULL, 0 } };
+		return i;
+	}
+};
+///////////////////////////////////////////////////////////////////////////////
+
 
 ///////////////////////////////////////////////////////////////////////////////
 /*
@@ -1,7 +1,1118 @@
 #include "lz4fio.h"
 #include <string.h>
+#include <stdlib.h>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#define O_BINARY 0
+#endif
 
-int main( int argc, char* argv[] )
+/*
+	zz bytes of text in a new array, made of the letters of word
+	with a newline every nl bytes when nl is not 0
+*/
+char* test_text( const size_t zz, const char* word, const size_t nl )
+{
+	char* p = new char[zz+1];
+	const size_t k = strlen(word);
+	for(size_t i=0; i<zz; ++i)
+		p[i] = (0<nl && 0==i%nl) ? '\n' : word[(i*i/7)%k];
+	p[zz] = 0;
+	return p;
+}
+
+/*
+	write zz bytes of utext to fn in wmode, returns the size of
+	the file or -1 when any step fails
+*/
+long long test_write( const char* fn, const char* wmode, const void* utext, const size_t zz )
+{
+	lz4File f = lz4open(fn,wmode);
+	size_t zw = (NULL!=f) ? lz4write( f, utext, zz ) : 0;
+	if(NULL==f || 0!=lz4close(f) || zz!=zw)
+		return -1;
+	long long z = -1;
+	FILE* fp = fopen(fn,"rb");
+	if(NULL!=fp && 0==fseek(fp,0,SEEK_END))
+		z = ftell(fp);
+	if(NULL!=fp)
+		fclose(fp);
+	return z;
+}
+
+/*
+	write zz bytes of utext to fn in wmode and open fn again in
+	rmode, NULL when any step fails
+*/
+lz4File test_reopen( const char* fn, const char* wmode, const char* rmode, const void* utext, const size_t zz )
+{
+	return (0<test_write( fn, wmode, utext, zz )) ? lz4open(fn,rmode) : NULL;
+}
+
+/*
+	the bytes of the file fn in a new array, NULL when the file
+	cannot be read
+*/
+char* test_load( const char* fn, size_t* pz )
+{
+	char* p = NULL;
+	FILE* fp = fopen(fn,"rb");
+	long long z = (NULL!=fp && 0==fseek(fp,0,SEEK_END)) ? ftell(fp) : -1;
+	if(0<z && 0==fseek(fp,0,SEEK_SET))
+	{
+		p = new char[(size_t)z];
+		if(1!=fread(p,(size_t)z,1,fp))
+		{
+			delete [] p;
+			p = NULL;
+		}
+	}
+	if(NULL!=fp)
+		fclose(fp);
+	*pz = (NULL!=p) ? (size_t)z : 0;
+	return p;
+}
+
+/*
+	print how a test went and pass its result on
+*/
+int test_report( const int result, const char* name, const char* wmode = NULL, const char* rmode = NULL )
+{
+	printf("%s",name);
+	if(NULL!=wmode)
+		printf(" %s %s",wmode,rmode);
+	if(0==result)
+		printf(": success!\n");
+	else
+		printf(": failed with error %d\n",lz4ferr);
+	return result;
+}
+
+/*
+	round trip a few blocks of generated text through one
+	write mode and one read mode
+*/
+int test_mode( const char* wmode, const char* rmode )
+{
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "lz4fio", 61 );
+	char* dtext = new char[zz];
+
+	int result = -1;
+	lz4File f = test_reopen( "mt.lz4", wmode, rmode, utext, zz );
+	if(NULL!=f)
+	{
+		if(zz==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,zz))
+			result = 0;
+		lz4close(f);
+	}
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "modes", wmode, rmode );
+}
+
+/*
+	the edges of a stream: nothing at all, exactly one block, a
+	file cut off half way, and a handle used the wrong way round,
+	which must fail at once instead of waiting on the workers
+*/
+int test_edges( const char* wmode, const char* rmode, const size_t bsize )
+{
+	const char *fned="ed.lz4";
+	const size_t zz = 5*bsize + bsize/2;
+	char* utext = test_text( zz, "edges", 57 );
+	char* dtext = new char[zz];
+
+	bool ok = true;
+	const size_t sizes[] = { 0, 1, bsize };
+	for(int i=0; ok && i<3; ++i)
+	{
+		lz4File f = test_reopen( fned, wmode, rmode, utext, sizes[i] );
+		ok = NULL!=f && sizes[i]==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,sizes[i]) && 0!=lz4eof(f);
+		if(NULL!=f)
+			lz4close(f);
+	}
+
+	lz4File f = ok ? lz4open(fned,wmode) : NULL;
+	ok = NULL!=f && 0==lz4read( f, dtext, 10 ) && lz4f_bad_arg==lz4ferr && NULL==lz4gets( f, dtext, 10 );
+	ok = ok && 10==lz4write( f, utext, 10 );
+	if(NULL!=f)
+		ok = (0==lz4close(f)) && ok;
+	f = ok ? lz4open(fned,rmode) : NULL;
+	ok = NULL!=f && 0==lz4write( f, utext, 10 ) && lz4f_bad_arg==lz4ferr;
+	ok = ok && 10==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,10);
+	if(NULL!=f)
+		lz4close(f);
+
+	// a file cut off half way gives the blocks before the cut and an error
+	size_t zf = 0;
+	char* pf = (ok && 0<test_write( fned, wmode, utext, zz )) ? test_load( fned, &zf ) : NULL;
+	FILE* fp = (NULL!=pf) ? fopen(fned,"wb") : NULL;
+	ok = NULL!=fp && zf/2==fwrite( pf, 1, zf/2, fp );
+	if(NULL!=fp)
+		ok = (0==fclose(fp)) && ok;
+	f = ok ? lz4open(fned,rmode) : NULL;
+	if(NULL!=f)
+	{
+		size_t zr = lz4read( f, dtext, zz );
+		ok = zr<zz && 0==memcmp(utext,dtext,zr) && lz4f_ok!=lz4ferr;
+		lz4close(f);
+	}
+	else
+		ok = ok && lz4f_ok!=lz4ferr;
+
+	delete [] pf;
+	delete [] utext;
+	delete [] dtext;
+	return test_report( ok ? 0 : -1, "edges", wmode, rmode );
+}
+
+/*
+	blocks are independent of the state a worker kept from earlier
+	blocks, so writing on worker threads must give the very same
+	bytes as writing on the caller, and a first view of the file
+	must hand out exactly one block of the size the mode asked for
+*/
+int test_blocks( const char* wmode, const size_t bsize )
+{
+	const char *fnb1="b1.lz4";
+	const char *fnbt="bt.lz4";
+	const size_t zz = 1500000;
+	char* utext = test_text( zz, "blocksize", 0 );
+	char* dtext = new char[zz];
+
+	char tmode[16];
+	sprintf( tmode, "%st3", wmode );
+	size_t z1 = 0;
+	size_t zt = 0;
+	char* f1 = (0<test_write( fnb1, wmode, utext, zz )) ? test_load( fnb1, &z1 ) : NULL;
+	char* ft = (0<test_write( fnbt, tmode, utext, zz )) ? test_load( fnbt, &zt ) : NULL;
+	int result = -1;
+	if(NULL!=f1 && NULL!=ft && z1==zt && 0==memcmp(f1,ft,z1))
+	{
+		lz4File f = lz4open(fnbt,"r");
+		bool ok = NULL!=f && zz==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,zz);
+		if(NULL!=f)
+			lz4close(f);
+		f = lz4open(fnb1,"rt2");
+		const void* p = NULL;
+		size_t n = 0;
+		ok = ok && NULL!=f && 0==lz4read_view( f, &p, &n ) && bsize==n && 0==memcmp(utext,p,n);
+		if(NULL!=f)
+			lz4close(f);
+		if(ok)
+			result = 0;
+	}
+
+	delete [] utext;
+	delete [] dtext;
+	delete [] f1;
+	delete [] ft;
+	return test_report( result, "blocks", wmode, tmode );
+}
+
+/*
+	"w0" to "w2" and "wf" run the fast compressor, which is not as
+	tight as high compression, and levels out of range are refused
+*/
+int test_levels()
+{
+	const char *fnlv="lv.lz4";
+	const size_t zz = 500000;
+	char* utext = test_text( zz, "levels", 61 );
+
+	const char* wmodes[] = { "w9", "w0", "w1", "w2", "wf" };
+	long long zsize[5] = { 0, 0, 0, 0, 0 };
+	int result = 0;
+	for(int i=0; i<5 && 0==result; ++i)
+	{
+		zsize[i] = test_write( fnlv, wmodes[i], utext, zz );
+		if(0>=zsize[i] || (0<i && zsize[i]<=zsize[0]))
+			result = -1;
+	}
+	const char* bad[] = { "w17", "wf65537", "wf999999" };
+	for(int i=0; i<3 && 0==result; ++i)
+	{
+		lz4File f = lz4open(fnlv,bad[i]);
+		if(NULL!=f || lz4f_bad_arg!=lz4ferr)
+			result = -1;
+		if(NULL!=f)
+			lz4close(f);
+	}
+
+	delete [] utext;
+	return test_report( result, "levels" );
+}
+
+/*
+	linked blocks must see the 64KB before them and not only the
+	block before, so a 16KB period in the input compresses to
+	almost nothing where independent blocks store each period
+*/
+int test_linked( const char* wmode, const char* rmode )
+{
+	const char *fnlk="lk.lz4";
+	const size_t zz = 1000000;
+	char* utext = new char[zz];
+	char* dtext = new char[zz];
+	unsigned int r = 1;
+	for(size_t i=0; i<zz; ++i)
+	{
+		if(i < 16*1024)
+		{
+			r = r*1103515245 + 12345;
+			utext[i] = (char)(r >> 16);
+		}
+		else
+			utext[i] = utext[i - 16*1024];
+	}
+
+	char imode[16];
+	strcpy( imode, wmode );
+	*strstr( imode, "BD" ) = 0;
+	long long zi = test_write( fnlk, imode, utext, zz );
+	long long zl = test_write( fnlk, wmode, utext, zz );
+	int result = -1;
+	lz4File f = (0<zl) ? lz4open(fnlk,rmode) : NULL;
+	if(NULL!=f)
+	{
+		if(zz==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,zz) && 4*zl<zi)
+			result = 0;
+		lz4close(f);
+	}
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "linked", wmode, rmode );
+}
+
+/*
+	format numbered lines straight into the staging block
+	through lz4write_reserve and read them back
+*/
+int test_reserve()
+{
+	const char *fnrc="rc.lz4";
+	const int nlines = 20000;
+	int result = -1;
+	lz4File f = lz4open(fnrc,"wB2");
+	if(NULL!=f)
+	{
+		int i = 0;
+		for(; i<nlines; ++i)
+		{
+			char* p = (char*)lz4write_reserve( f, 32 );
+			if(NULL==p)
+				break;
+			int n = sprintf(p,"line %d\n",i);
+			if((size_t)n != lz4write_commit( f, n ))
+				break;
+		}
+		if(0==lz4close(f) && nlines==i)
+		{
+			f = lz4open(fnrc,"r");
+			if(NULL!=f)
+			{
+				char line[32];
+				for(i=0; i<nlines; ++i)
+				{
+					char expect[32];
+					sprintf(expect,"line %d\n",i);
+					if(NULL==lz4gets(f,line,sizeof(line)) || 0!=strcmp(line,expect))
+						break;
+				}
+				if(nlines==i)
+					result = 0;
+				lz4close(f);
+			}
+		}
+	}
+	return test_report( result, "reserve/commit" );
+}
+
+/*
+	read 0 separated records with lz4getdelim, records cross
+	block boundaries and some are longer than the caller buffer
+*/
+int test_getdelim()
+{
+	const char *fnrc="rc.lz4";
+	const int nrecs = 3000;
+	int result = -1;
+	lz4File f = lz4open(fnrc,"wB2");
+	if(NULL!=f)
+	{
+		char rec[64];
+		for(int i=0; i<nrecs; ++i)
+		{
+			size_t n = sprintf(rec,"record %d %.*s",i,i%40,"........................................");
+			lz4write( f, rec, n+1 );
+		}
+		if(0==lz4close(f))
+		{
+			f = lz4open(fnrc,"r");
+			if(NULL!=f)
+			{
+				char got[32];
+				int i = 0;
+				for(; i<nrecs; ++i)
+				{
+					size_t n = sprintf(rec,"record %d %.*s",i,i%40,"........................................")+1;
+					size_t z = 0;
+					while(z < n)
+					{
+						size_t zr = lz4getdelim( f, got, sizeof(got), 0 );
+						if(0==zr || 0!=memcmp(got,rec+z,zr))
+							break;
+						z += zr;
+					}
+					if(z!=n)
+						break;
+				}
+				if(nrecs==i && 0==lz4getdelim( f, got, sizeof(got), 0 ) && lz4f_ok==lz4ferr)
+					result = 0;
+				lz4close(f);
+			}
+		}
+	}
+	return test_report( result, "getdelim" );
+}
+
+/*
+	walk lines with lz4f_lines_s, small blocks make many lines
+	cross a block boundary and some span several blocks
+*/
+int test_lines()
+{
+	const char *fnrc="rc.lz4";
+	const int nlines = 2000;
+	char* big = new char[10000];
+	memset(big,'x',10000);
+	int result = -1;
+	lz4File f = lz4open(fnrc,"wB2");
+	if(NULL!=f)
+	{
+		for(int i=0; i<nlines; ++i)
+		{
+			lz4write( f, big, (i*37)%(0==i%100 ? 10000 : 300) );
+			lz4write( f, "\n", 1 );
+		}
+		if(0==lz4close(f))
+		{
+			f = lz4open(fnrc,"r");
+			if(NULL!=f)
+			{
+				int i = 0;
+				for( lz4f_line_s line : lz4f_lines_s(f) )
+				{
+					size_t n = (i*37)%(0==i%100 ? 10000 : 300);
+					if(line.n != n+1 || '\n'!=line.p[n] || 0!=memcmp(line.p,big,n))
+						break;
+					++i;
+				}
+				if(nlines==i && lz4f_ok==lz4ferr)
+					result = 0;
+				lz4close(f);
+			}
+		}
+	}
+	delete [] big;
+	return test_report( result, "lines" );
+}
+
+/*
+	read a file through lz4read_view, lz4read and lz4gets in turn
+	and check that each view still holds its bytes after a pause,
+	while workers or the linked ring may be filling other blocks
+*/
+int test_view( const char* wmode, const char* rmode )
+{
+	const size_t zz = 400000;
+	char* utext = test_text( zz, "readview", 61 );
+
+	int result = -1;
+	lz4File f = test_reopen( "vw.lz4", wmode, rmode, utext, zz );
+	if(NULL!=f)
+	{
+		size_t at = 0;
+		bool ok = true;
+		char line[100];
+		char buf[777];
+		for(int i=0; ok && at<zz; ++i)
+		{
+			if(0==i%3)
+			{
+				const void* p = NULL;
+				size_t n = 0;
+				ok = 0==lz4read_view( f, &p, &n ) && 0<n && at+n<=zz;
+				std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+				ok = ok && 0==memcmp(utext+at,p,n);
+				at += n;
+			}
+			else
+			if(1==i%3)
+			{
+				size_t n = lz4read( f, buf, sizeof(buf) );
+				ok = 0<n && at+n<=zz && 0==memcmp(utext+at,buf,n);
+				at += n;
+			}
+			else
+			{
+				ok = NULL!=lz4gets( f, line, sizeof(line) );
+				size_t n = ok ? strlen(line) : 0;
+				ok = ok && 0<n && at+n<=zz && 0==memcmp(utext+at,line,n);
+				at += n;
+			}
+		}
+		const void* p = NULL;
+		size_t n = 1;
+		if(ok && zz==at && 0==lz4read_view( f, &p, &n ) && 0==n && 0!=lz4eof(f))
+			result = 0;
+		lz4close(f);
+	}
+
+	delete [] utext;
+	return test_report( result, "view", wmode, rmode );
+}
+
+/*
+	read short ranges at scattered offsets through lz4seek
+*/
+int test_seek( const char* wmode, const char* rmode )
+{
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "seeking", 0 );
+
+	int result = -1;
+	lz4File f = test_reopen( "rc.lz4", wmode, rmode, utext, zz );
+	if(NULL!=f)
+	{
+		char dtext[100];
+		const long long offs[] = { 250000, 7, 123456, 123400, 299950, 0, 65536 };
+		int i = 0;
+		for(; i<(int)(sizeof(offs)/sizeof(offs[0])); ++i)
+		{
+			if(offs[i] != lz4seek( f, offs[i], SEEK_SET ))
+				break;
+			size_t zr = lz4read( f, dtext, sizeof(dtext) );
+			if(zr != ((zz - offs[i] < sizeof(dtext)) ? zz - offs[i] : sizeof(dtext)))
+				break;
+			if(0!=memcmp( dtext, utext + offs[i], zr ) || offs[i] + (long long)zr != lz4tell(f))
+				break;
+		}
+		if(7==i && (long long)zz - 10 == lz4seek( f, -10, SEEK_END ) && 10 == lz4read( f, dtext, sizeof(dtext) ))
+			result = 0;
+		lz4close(f);
+	}
+
+	delete [] utext;
+	return test_report( result, "seek", wmode, rmode );
+}
+
+/*
+	serve scattered ranges of one handle from several threads
+*/
+int test_pread()
+{
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "pread", 0 );
+
+	int result = -1;
+	lz4File f = test_reopen( "rc.lz4", "wB2", "r", utext, zz );
+	if(NULL!=f)
+	{
+		int bad[4] = {0,0,0,0};
+		std::thread t[4];
+		for(int i=0; i<4; ++i)
+		{
+			t[i] = std::thread( [=,&bad]()
+			{
+				char dtext[10000];
+				for(size_t j=0; j<200; ++j)
+				{
+					size_t off = (j*7919 + i*104729) % zz;
+					size_t n = (j*j) % sizeof(dtext);
+					size_t zr = lz4pread( f, dtext, n, off );
+					size_t ze = (zz - off < n) ? zz - off : n;
+					if(zr != ze || 0!=memcmp( dtext, utext + off, zr ))
+						++bad[i];
+				}
+			});
+		}
+		for(int i=0; i<4; ++i)
+			t[i].join();
+		if(0==bad[0]+bad[1]+bad[2]+bad[3])
+			result = 0;
+		lz4close(f);
+	}
+
+	delete [] utext;
+	return test_report( result, "pread" );
+}
+
+/*
+	write after a plain prefix through a FILE and read it back
+	through a descriptor positioned past the prefix
+*/
+int test_dopen()
+{
+	const char *fndo="do.lz4";
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "dopen", 53 );
+	char* dtext = new char[zz];
+
+	int result = -1;
+	FILE* fp = fopen(fndo,"wb");
+	if(NULL!=fp && 4==fwrite("pfx:",1,4,fp))
+	{
+		lz4File f = lz4fopen(fp,"wB2");
+		if(NULL!=f)
+		{
+			size_t zw = lz4write( f, utext, zz );
+			if(0==lz4close(f) && zz==zw)
+			{
+				int fd = open(fndo,O_RDONLY|O_BINARY);
+				char pfx[4];
+				if(0<=fd && 4==read(fd,pfx,4) && 0==memcmp(pfx,"pfx:",4))
+				{
+					f = lz4dopen(fd,"r");
+					// fd stays in use by f and is not handed out again
+					int fd2 = open(fndo,O_RDONLY|O_BINARY);
+					if(0<=fd2)
+						close(fd2);
+					if(NULL!=f)
+					{
+						size_t zr = lz4read( f, dtext, zz );
+						if(zz==zr && 0==memcmp(utext,dtext,zz) && 1000==lz4seek(f,1000,SEEK_SET))
+						{
+							zr = lz4read( f, dtext, 5000 );
+							if(5000==zr && 0==memcmp(utext+1000,dtext,5000) && fd!=fd2)
+								result = 0;
+						}
+						lz4close(f);
+					}
+				}
+			}
+		}
+	}
+	else
+	if(NULL!=fp)
+		fclose(fp);
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "dopen" );
+}
+
+/*
+	round trip through memory twice, the second stream reuses
+	the buffer grown by the first
+*/
+int test_memory()
+{
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "memory", 67 );
+	char* dtext = new char[zz];
+
+	int result = 0;
+	void* pmem = NULL;
+	size_t zmem = 0;
+	for(int pass=0; pass<2 && 0==result; ++pass)
+	{
+		result = -1;
+		lz4File f = lz4memopen_grow(&pmem,&zmem,(0==pass)?"wB2":"w9B2t2");
+		if(NULL==f)
+			break;
+		size_t zw = lz4write( f, utext, zz );
+		if(0!=lz4close(f) || zz!=zw || NULL==pmem)
+			break;
+		f = lz4memopen(pmem,zmem,"r");
+		if(NULL==f)
+			break;
+		char line[128];
+		if(NULL!=lz4gets(f,line,sizeof(line)) && 0==strncmp(line,utext,strlen(line)) && '\n'==line[strlen(line)-1])
+		{
+			size_t zr = lz4read( f, dtext, zz );
+			size_t zl = strlen(line);
+			if(zz-zl==zr && 0==memcmp(utext+zl,dtext,zr) && 0!=lz4eof(f) && 70000==lz4seek(f,70000,SEEK_SET))
+			{
+				zr = lz4pread( f, dtext, 9000, 123456 );
+				if(9000==zr && 0==memcmp(utext+123456,dtext,zr))
+				{
+					zr = lz4read( f, dtext, 3000 );
+					if(3000==zr && 0==memcmp(utext+70000,dtext,zr))
+						result = 0;
+				}
+			}
+		}
+		lz4close(f);
+	}
+	free(pmem);
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "memory" );
+}
+
+/*
+	input that is not lz4 is read as it is, from a file in
+	each read mode, from memory, and when shorter than a header
+*/
+int test_plain()
+{
+	const char *fnpl="pl.txt";
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "plain", 61 );
+	char* dtext = new char[zz];
+
+	int result = -1;
+	FILE* fp = fopen(fnpl,"wb");
+	if(NULL!=fp && zz==fwrite(utext,1,zz,fp) && 0==fclose(fp))
+	{
+		const char* rmodes[] = { "r", "rm", "ru", "rt2" };
+		int i = 0;
+		for(; i<(int)(sizeof(rmodes)/sizeof(rmodes[0])); ++i)
+		{
+			lz4File f = (3==i) ? lz4memopen(utext,zz,rmodes[i]) : lz4open(fnpl,rmodes[i]);
+			if(NULL==f)
+				break;
+			char line[128];
+			bool ok = (NULL!=lz4gets(f,line,sizeof(line)) && 0==strncmp(line,utext,strlen(line)));
+			size_t zl = ok ? strlen(line) : 0;
+			ok = ok && (zz-zl == lz4read( f, dtext, zz )) && 0==memcmp(utext+zl,dtext,zz-zl) && 0!=lz4eof(f);
+			ok = ok && 70000==lz4seek(f,70000,SEEK_SET) && 3000==lz4read( f, dtext, 3000 ) && 0==memcmp(utext+70000,dtext,3000);
+			ok = ok && 9000==lz4pread( f, dtext, 9000, 123456 ) && 0==memcmp(utext+123456,dtext,9000);
+			ok = ok && (long long)zz-10==lz4seek(f,-10,SEEK_END) && 10==lz4read( f, dtext, 100 ) && 0==memcmp(utext+zz-10,dtext,10);
+			lz4close(f);
+			if(!ok)
+				break;
+		}
+		lz4File f = lz4memopen("hi",2,"r");
+		if(4==i && NULL!=f && 2==lz4read( f, dtext, 100 ) && 0==memcmp(dtext,"hi",2) && 0!=lz4eof(f))
+			result = 0;
+		if(NULL!=f)
+			lz4close(f);
+#ifndef _WIN32
+		// a pipe cannot go back, which must leave the position as it was
+		// the bytes fit the pipe so the writer is done whatever happens
+		const size_t zp = 60000;
+		int pfd[2];
+		if(0==result && 0==pipe(pfd))
+		{
+			std::thread t( [&]()
+			{
+				for(size_t n=0; n<zp; )
+				{
+					ssize_t k = write(pfd[1],utext+n,zp-n);
+					if(0>=k)
+						break;
+					n += k;
+				}
+				close(pfd[1]);
+			});
+			f = lz4dopen(pfd[0],"r");
+			bool ok = NULL!=f && 5000==lz4read( f, dtext, 5000 );
+			ok = ok && -1==lz4seek(f,100,SEEK_SET) && 5000==lz4tell(f);
+			ok = ok && 9000==lz4seek(f,9000,SEEK_SET) && zp-9000==lz4read( f, dtext, zz ) && 0==memcmp(utext+9000,dtext,zp-9000);
+			if(NULL!=f)
+				lz4close(f);
+			else
+				close(pfd[0]);
+			t.join();
+			if(!ok)
+				result = -1;
+		}
+#endif
+	}
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "plain" );
+}
+
+/*
+	three frames appended to one file, with other block sizes and
+	linked blocks, then two files joined in memory as cat does
+*/
+int test_append()
+{
+	const char *fnap="ap.lz4";
+	const size_t zz = 300000;
+	const size_t za = 100000;
+	const size_t zb = 70000;
+	char* utext = test_text( zz, "append", 71 );
+	char* dtext = new char[zz];
+
+	int result = -1;
+	const char* wmodes[] = { "wB2", "a9B3t2", "abBD" };
+	const size_t offs[] = { 0, za, za+zb, zz };
+	int i = 0;
+	for(; i<3; ++i)
+	{
+		if(0>=test_write( fnap, wmodes[i], utext + offs[i], offs[i+1] - offs[i] ))
+			break;
+	}
+	const char* rmodes[] = { "r", "rt2", "rm", "ru" };
+	int j = 0;
+	for(; 3==i && j<(int)(sizeof(rmodes)/sizeof(rmodes[0])); ++j)
+	{
+		lz4File f = lz4open(fnap,rmodes[j]);
+		if(NULL==f)
+			break;
+		bool ok = (zz == lz4read( f, dtext, zz )) && 0==memcmp(utext,dtext,zz) && 0==lz4read( f, dtext, 1 ) && 0!=lz4eof(f);
+		ok = ok && (long long)zz-10==lz4seek(f,-10,SEEK_END) && 10==lz4read( f, dtext, 100 ) && 0==memcmp(utext+zz-10,dtext,10);
+		ok = ok && 1000==lz4seek(f,1000,SEEK_SET) && 3000==lz4read( f, dtext, 3000 ) && 0==memcmp(utext+1000,dtext,3000);
+		ok = ok && za+zb-50==lz4seek(f,za+zb-50,SEEK_SET) && 100==lz4read( f, dtext, 100 ) && 0==memcmp(utext+za+zb-50,dtext,100);
+		lz4close(f);
+		if(!ok)
+			break;
+	}
+
+	void* pmem = NULL;
+	size_t zmem = 0;
+	void* pcat = NULL;
+	size_t zcat = 0;
+	lz4File f = lz4memopen_grow(&pmem,&zmem,"wB2");
+	size_t zw = (NULL!=f) ? lz4write( f, utext, za ) : 0;
+	if(NULL!=f && 0==lz4close(f) && za==zw && 4==j)
+	{
+		// the second stream is written after the bytes of the first
+		pcat = malloc(zmem);
+		zcat = zmem;
+		memcpy( pcat, pmem, zmem );
+		f = lz4memopen_grow(&pcat,&zcat,"a");
+		zw = (NULL!=f) ? lz4write( f, utext + za, zz - za ) : 0;
+		if(NULL!=f && 0==lz4close(f) && zz-za==zw)
+		{
+			f = lz4memopen(pcat,zcat,"r");
+			if(NULL!=f && zz==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,zz) && 0==lz4read( f, dtext, 1 ) && 0!=lz4eof(f))
+				result = 0;
+			if(NULL!=f)
+				lz4close(f);
+		}
+	}
+	// a stream written before the index was added ends at its end mark
+	void* pold = NULL;
+	size_t zold = 0;
+	if(0==result && 24<zmem)
+	{
+		// the index is 16 bytes per block and a tail of 24 that starts with the count
+		result = -1;
+		unsigned long long count = 0;
+		memcpy( &count, (char*)pmem + zmem - 24, sizeof(count) );
+		zold = zmem - 24 - (size_t)count*16;
+		pold = malloc(zold);
+		memcpy( pold, pmem, zold );
+		f = lz4memopen_grow(&pold,&zold,"a9B3");
+		zw = (NULL!=f) ? lz4write( f, utext + za, zz - za ) : 0;
+		if(NULL!=f && 0==lz4close(f) && zz-za==zw)
+		{
+			f = lz4memopen(pold,zold,"r");
+			if(NULL!=f && zz==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,zz) && 0==lz4read( f, dtext, 1 ) && 0!=lz4eof(f))
+				result = 0;
+			if(NULL!=f)
+				lz4close(f);
+		}
+	}
+	free(pmem);
+	free(pcat);
+	free(pold);
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "append" );
+}
+
+/*
+	small json records compressed against a dictionary of other
+	records, independent blocks must beat the same blocks without it
+*/
+int test_dict( const char* wmode, const char* rmode )
+{
+	const char *fndi="di.lz4";
+	const size_t zz = 200000;
+	char* utext = new char[zz+200];
+	char* dtext = new char[zz];
+	char* dict = new char[100000];
+	size_t nd = 0;
+	size_t nu = 0;
+	for(int i=0; nd<90000; ++i)
+		nd += sprintf( dict+nd, "{\"id\":%d,\"name\":\"user%d\",\"email\":\"user%d@example.com\",\"active\":%s}\n", i, i*7, i*7, (i%3) ? "true" : "false" );
+	for(int i=5000; nu<zz; ++i)
+		nu += sprintf( utext+nu, "{\"id\":%d,\"name\":\"user%d\",\"email\":\"user%d@example.com\",\"active\":%s}\n", i, i*13, i*13, (i%5) ? "true" : "false" );
+
+	int result = -1;
+	long long zplain = test_write( "nd.lz4", wmode, utext, zz );
+	long long zdict = -1;
+	lz4File f = lz4open_dict(fndi,wmode,dict,nd);
+	size_t zw = (NULL!=f) ? lz4write( f, utext, zz ) : 0;
+	if(NULL!=f && 0==lz4close(f) && zz==zw)
+	{
+		FILE* fp = fopen(fndi,"rb");
+		if(NULL!=fp && 0==fseek(fp,0,SEEK_END))
+			zdict = ftell(fp);
+		if(NULL!=fp)
+			fclose(fp);
+	}
+	// linked blocks already have history so only the first block gains
+	if(0<zdict && (zdict<zplain || NULL!=strstr(wmode,"BD")))
+	{
+		bool ok = false;
+		f = lz4open_dict(fndi,rmode,dict,nd);
+		if(NULL!=f)
+		{
+			ok = (zz==lz4read( f, dtext, zz )) && 0==memcmp(utext,dtext,zz);
+			ok = ok && 1000==lz4seek(f,1000,SEEK_SET) && 3000==lz4read( f, dtext, 3000 ) && 0==memcmp(utext+1000,dtext,3000);
+			if(NULL==strstr(wmode,"BD"))
+				ok = ok && 9000==lz4pread( f, dtext, 9000, 123456 ) && 0==memcmp(utext+123456,dtext,9000);
+			lz4close(f);
+		}
+		// without the dictionary the id is there but the blocks are not
+		f = lz4open(fndi,rmode);
+		if(NULL!=f)
+		{
+			ok = ok && lz4dictid(f)==lz4dictid_of(dict,nd) && 0==lz4read( f, dtext, zz ) && lz4f_bad_dict==lz4ferr;
+			lz4close(f);
+		}
+		f = lz4open_dict(fndi,rmode,dict,nd-1);
+		ok = ok && NULL==f && lz4f_bad_dict==lz4ferr;
+		if(NULL!=f)
+			lz4close(f);
+		if(ok)
+			result = 0;
+	}
+
+	delete [] utext;
+	delete [] dtext;
+	delete [] dict;
+	return test_report( result, "dict", wmode, rmode );
+}
+
+/*
+	a file written with a dictionary through a pipe, where the
+	position of the first block is known only from the header,
+	must still index its blocks at their offsets in the file
+*/
+int test_dict_pipe()
+{
+	int result = -1;
+#ifndef _WIN32
+	const char *fndp="dp.lz4";
+	const size_t zz = 300000;
+	char* utext = new char[zz+200];
+	char* dtext = new char[zz];
+	char* dict = new char[40000];
+	size_t nd = 0;
+	size_t nu = 0;
+	for(int i=0; nd<30000; ++i)
+		nd += sprintf( dict+nd, "{\"id\":%d,\"name\":\"user%d\"}\n", i, i*7 );
+	for(int i=5000; nu<zz; ++i)
+		nu += sprintf( utext+nu, "{\"id\":%d,\"name\":\"user%d\"}\n", i, i*13 );
+
+	int pfd[2];
+	if(0==pipe(pfd))
+	{
+		bool written = false;
+		std::thread t( [&]()
+		{
+			char fn[32];
+			sprintf( fn, "/dev/fd/%d", pfd[1] );
+			lz4File f = lz4open_dict(fn,"wB2",dict,nd);
+			size_t zw = (NULL!=f) ? lz4write( f, utext, zz ) : 0;
+			written = (NULL!=f && 0==lz4close(f) && zz==zw);
+			close(pfd[1]);
+		});
+		FILE* fp = fopen(fndp,"wb");
+		char buf[4096];
+		for(int n; 0<(n = (int)read(pfd[0],buf,sizeof(buf))); )
+		{
+			if(NULL!=fp)
+				fwrite( buf, 1, n, fp );
+		}
+		t.join();
+		close(pfd[0]);
+		if(NULL!=fp && 0==fclose(fp) && written)
+		{
+			lz4File f = lz4open_dict(fndp,"r",dict,nd);
+			if(NULL!=f)
+			{
+				if(9000==lz4pread( f, dtext, 9000, 123456 ) && 0==memcmp(utext+123456,dtext,9000)
+					&& zz==lz4read( f, dtext, zz ) && 0==memcmp(utext,dtext,zz))
+					result = 0;
+				lz4close(f);
+			}
+		}
+	}
+	delete [] utext;
+	delete [] dtext;
+	delete [] dict;
+#else
+	result = 0;
+#endif
+	return test_report( result, "dict pipe" );
+}
+
+int test_train()
+{
+	const size_t ns = 4000;
+	const size_t nheld = 400;
+	char* samples = new char[ns*200];
+	size_t* sizes = new size_t[ns];
+	char* dict1 = new char[16*1024];
+	char* dict4 = new char[16*1024];
+	size_t n = 0;
+	const char* cities[] = { "Oslo", "Lima", "Perth", "Quito", "Accra" };
+	for(size_t i=0; i<ns; ++i)
+	{
+		sizes[i] = sprintf( samples+n, "{\"id\":%u,\"user\":\"user%u\",\"city\":\"%s\",\"score\":%u,\"tags\":[\"t%u\",\"t%u\"],\"active\":%s}",
+			(unsigned)(i*7919), (unsigned)(i*31), cities[i%5], (unsigned)((i*37)%1000), (unsigned)(i%11), (unsigned)(i%17), (i%3) ? "true" : "false" );
+		n += sizes[i];
+	}
+	// the last records are held out of training
+	size_t nt = n;
+	for(size_t i=ns-nheld; i<ns; ++i)
+		nt -= sizes[i];
+
+	int result = -1;
+	size_t z1 = lz4dict_train( dict1, 16*1024, samples, sizes, ns-nheld, 1 );
+	size_t z4 = lz4dict_train( dict4, 16*1024, samples, sizes, ns-nheld, 4 );
+	if(0<z1 && 16*1024>=z1 && z1==z4 && 0==memcmp(dict1,dict4,z1))
+	{
+		double rplain = lz4dict_ratio( NULL, 0, samples+nt, sizes+ns-nheld, nheld, 9, 2 );
+		double rdict = lz4dict_ratio( dict1, z1, samples+nt, sizes+ns-nheld, nheld, 9, 2 );
+		if(0<rplain && rplain<rdict)
+			result = 0;
+	}
+
+	delete [] samples;
+	delete [] sizes;
+	delete [] dict1;
+	delete [] dict4;
+	return test_report( result, "train" );
+}
+
+/*
+	a fake storage layer for lz4open_io that hands out short
+	reads and writes of at most 1000 bytes and holds cap bytes
+*/
+struct test_store_s
+{
+	char* p;
+	size_t size;
+	size_t pos;
+	int closed;
+	size_t cap;
+};
+
+size_t test_store_read( void* user, void* pbytes, size_t nbytes )
+{
+	test_store_s* s = (test_store_s*)user;
+	size_t n = s->size - s->pos;
+	n = (n < nbytes) ? n : nbytes;
+	n = (n < 1000) ? n : 1000;
+	memcpy(pbytes,s->p+s->pos,n);
+	s->pos += n;
+	return n;
+}
+
+size_t test_store_write( void* user, const void* pbytes, size_t nbytes )
+{
+	test_store_s* s = (test_store_s*)user;
+	size_t n = (nbytes < 1000) ? nbytes : 1000;
+	if(s->pos + n > s->cap)
+		return 0;
+	memcpy(s->p+s->pos,pbytes,n);
+	s->pos += n;
+	s->size = (s->pos > s->size) ? s->pos : s->size;
+	return n;
+}
+
+long long test_store_seek( void* user, long long off, int whence )
+{
+	test_store_s* s = (test_store_s*)user;
+	long long at = off + ((SEEK_CUR==whence) ? s->pos : (SEEK_END==whence) ? s->size : 0);
+	if(0>at || (size_t)at > s->size)
+		return -1;
+	s->pos = (size_t)at;
+	return at;
+}
+
+int test_store_close( void* user )
+{
+	((test_store_s*)user)->closed++;
+	return 0;
+}
+
+/*
+	round trip through the callbacks, with seek and without,
+	then fill the store up in the middle of the stream
+*/
+int test_io()
+{
+	const size_t zz = 300000;
+	char* utext = test_text( zz, "vtable", 71 );
+	char* dtext = new char[zz];
+
+	test_store_s s = { new char[1000000], 0, 0, 0, 1000000 };
+	lz4f_io_vtable_s vt = { test_store_read, test_store_write, test_store_seek, test_store_close };
+	int result = 0;
+	for(int pass=0; pass<2 && 0==result; ++pass)
+	{
+		result = -1;
+		if(1==pass)
+			vt.seek = NULL;
+		s.size = s.pos = 0;
+		s.closed = 0;
+		lz4File f = lz4open_io(&vt,&s,(0==pass)?"wB2t2":"wB2");
+		if(NULL==f)
+			break;
+		size_t zw = lz4write( f, utext, zz );
+		if(0!=lz4close(f) || zz!=zw || 1!=s.closed)
+			break;
+		s.pos = 0;
+		f = lz4open_io(&vt,&s,(0==pass)?"rt2":"r");
+		if(NULL==f)
+			break;
+		size_t zr = lz4read( f, dtext, 1000 );
+		if(1000==zr && 0==memcmp(utext,dtext,zr) && 90000==lz4seek(f,90000,SEEK_SET))
+		{
+			zr = lz4read( f, dtext, zz );
+			if(zz-90000==zr && 0==memcmp(utext+90000,dtext,zr))
+			{
+				zr = lz4pread( f, dtext, 5000, 5000 );
+				if(0==pass && 5000==zr && 0==memcmp(utext+5000,dtext,zr))
+					result = 0;
+				if(1==pass && 0==zr && lz4f_bad_arg==lz4ferr)
+					result = 0;
+			}
+		}
+		lz4close(f);
+	}
+	// a write that fails half way fails the stream and still closes it
+	s.size = s.pos = 0;
+	s.closed = 0;
+	s.cap = 20000;
+	lz4File f = (0==result) ? lz4open_io(&vt,&s,"wB2t2") : NULL;
+	if(NULL!=f)
+	{
+		size_t zw = lz4write( f, utext, zz );
+		int rc = lz4close(f);
+		if((zz==zw && lz4f_ok==rc) || 1!=s.closed)
+			result = -1;
+	}
+	delete [] s.p;
+
+	delete [] utext;
+	delete [] dtext;
+	return test_report( result, "io" );
+}
+
+int main( int /*argc*/, char* /*argv*/[] )
 {
 	char utext[128];utext[0]=0;
 	sprintf(utext,"Hello from lz4fio %s\n", lz4f_version_string );
@@ -49,8 +1160,69 @@ int main( int argc, char* argv[] )
 	else
 		printf("error: decompressed text does not match original uncompressed text\n");
 
-	return 0;
-
-}
+	int failures = 0;
+	failures += (0!=test_mode("w9t4","r"));
+	failures += (0!=test_edges("w9t4","r",64*1024));
+	failures += (0!=test_mode("w9t4","rt4"));
+	failures += (0!=test_mode("w0","r"));
+	failures += (0!=test_mode("w1","rt2"));
+	failures += (0!=test_levels());
+	failures += (0!=test_mode("w9B3","r"));
+	failures += (0!=test_edges("wB2t2","rt4",4*1024));
+	failures += (0!=test_blocks("w9B2",4*1024));
+	failures += (0!=test_blocks("wfB3",16*1024));
+	failures += (0!=test_blocks("w1B4",64*1024));
+	failures += (0!=test_blocks("w9B5",256*1024));
+	failures += (0!=test_blocks("w2B6",1024*1024));
+	failures += (0!=test_mode("w9BD","r"));
+	failures += (0!=test_mode("wfB2BD","rb"));
+	failures += (0!=test_linked("w9B2BD","r"));
+	failures += (0!=test_linked("w9B3BD","rt2"));
+	failures += (0!=test_view("wB2","r"));
+	failures += (0!=test_view("wB2","rt2"));
+	failures += (0!=test_view("wB2BD","r"));
+	failures += (0!=test_view("w9B2BD","rt2"));
+	failures += (0!=test_reserve());
+	failures += (0!=test_mode("wf","rt2"));
+	failures += (0!=test_mode("w2","r"));
+	failures += (0!=test_getdelim());
+	failures += (0!=test_lines());
+	failures += (0!=test_seek("wB2","r"));
+	failures += (0!=test_seek("wB2t2","rt2"));
+	failures += (0!=test_seek("wB2BD","r"));
+	failures += (0!=test_pread());
+	failures += (0!=test_mode("w","rm"));
+	failures += (0!=test_mode("w9BD","rmt2"));
+	failures += (0!=test_mode("wfB3t2","rm"));
+	failures += (0!=test_edges("wB2BD","rm",4*1024));
+	failures += (0!=test_linked("wfB2BD","rm"));
+	failures += (0!=test_view("wB2","rm"));
+	failures += (0!=test_view("wB2BD","rm"));
+	failures += (0!=test_seek("wB2","rm"));
+	failures += (0!=test_seek("wsB2","r"));
+	failures += (0!=test_edges("wsB2","rt2",4*1024));
+	failures += (0!=test_dopen());
+	failures += (0!=test_memory());
+	failures += (0!=test_io());
+	failures += (0!=test_mode("wu","ru"));
+	failures += (0!=test_mode("w9t2u","rut2"));
+	failures += (0!=test_mode("wfBDu","rmu"));
+	failures += (0!=test_seek("wB2u","ru"));
+	failures += (0!=test_edges("wB2u","rut2",4*1024));
+	failures += (0!=test_mode("wF","r"));
+	failures += (0!=test_mode("w9FBDu","rt2"));
+	failures += (0!=test_seek("wFB2","r"));
+	failures += (0!=test_edges("wFB2","r",4*1024));
+	failures += (0!=test_plain());
+	failures += (0!=test_append());
+	failures += (0!=test_dict("w9B2","r"));
+	failures += (0!=test_dict("wfB2","rt2"));
+	failures += (0!=test_dict("w9B2BD","r"));
+	failures += (0!=test_dict("wB2t2","rm"));
+	failures += (0!=test_dict("wfB2BD","rmu"));
+	failures += (0!=test_dict_pipe());
+	failures += (0!=test_train());
 
+	return failures;
 
+}